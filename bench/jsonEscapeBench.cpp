@@ -0,0 +1,233 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Checks JsonWriter::AppendJsonString against a simple byte at a time
+// escaper on random strings full of control characters, quotes, and valid
+// and invalid UTF-8, then compares their throughput escaping the symbol
+// names (mangled and demangled) of real binaries:  the files given as
+// arguments, or this program and the shared libraries it has loaded.
+
+#include <cxxabi.h>
+#include <link.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "../jsonWriter.h"
+#include "../elfFile.h"
+
+const int numFuzzStrings = 200000;
+
+// results are stored here so the work is not optimized away
+volatile size_t benchSink;
+
+
+// Escapes s one byte at a time, decoding each UTF-8 sequence to a code point
+// to check it.
+std::string ReferenceEscape(const std::string &s)
+{
+    std::string out{"\""};
+    size_t i = 0;
+    while (i < s.size())  {
+	unsigned char c = s[i];
+	if (c < 0x80)  {
+	    if (c == '"' || c == '\\')  {
+		out += '\\';
+		out += c;
+	    }  else if (c == '\b')  {
+		out += "\\b";
+	    }  else if (c == '\f')  {
+		out += "\\f";
+	    }  else if (c == '\n')  {
+		out += "\\n";
+	    }  else if (c == '\r')  {
+		out += "\\r";
+	    }  else if (c == '\t')  {
+		out += "\\t";
+	    }  else if (c < 0x20)  {
+		char u[8];
+		snprintf(u, sizeof u, "\\u%04x", c);
+		out += u;
+	    }  else  {
+		out += c;
+	    }
+	    ++i;
+	    continue;
+	}
+
+	size_t len = (c >= 0xf8) ? 0 : (c >= 0xf0) ? 4 : (c >= 0xe0) ? 3 : (c >= 0xc0) ? 2 : 0;
+	uint32_t cp = c & (0x7f >> len);
+	bool valid = len > 0 && i + len <= s.size();
+	for (size_t j = 1; valid && j < len; ++j)  {
+	    unsigned char cont = s[i + j];
+	    valid = (cont & 0xc0) == 0x80;
+	    cp = (cp << 6) | (cont & 0x3f);
+	}
+	static const uint32_t minCodePoint[] = {0, 0, 0x80, 0x800, 0x10000};
+	valid = valid && cp >= minCodePoint[len] && cp <= 0x10ffff && (cp < 0xd800 || cp > 0xdfff);
+
+	if (valid)  {
+	    out.append(s, i, len);
+	    i += len;
+	}  else  {
+	    out += "\xef\xbf\xbd";
+	    ++i;
+	}
+    }
+    out += '"';
+
+    return out;
+}
+
+
+// Returns a string of up to 80 bytes, mostly printable ASCII mixed with
+// special characters, UTF-8 sequences of random code points (including
+// surrogates and values above U+10FFFF), truncated sequences and random bytes.
+std::string FuzzString(std::mt19937 &random)
+{
+    std::string s;
+    for (int n = random() % 80; n > 0; --n)  {
+	switch (random() % 8)  {
+	    case 0:
+		s += char(random() % 0x20);
+		break;
+	    case 1:
+		s += "\"\\\x7f"[random() % 3];
+		break;
+	    case 2:
+		s += char(random());
+		break;
+	    case 3:  {
+		uint32_t cp = random() % 0x120000;
+		if (cp < 0x800)  {
+		    s += char(0xc0 | (cp >> 6));
+		}  else if (cp < 0x10000)  {
+		    s += char(0xe0 | (cp >> 12));
+		    s += char(0x80 | ((cp >> 6) & 0x3f));
+		}  else  {
+		    s += char(0xf0 | (cp >> 18));
+		    s += char(0x80 | ((cp >> 12) & 0x3f));
+		    s += char(0x80 | ((cp >> 6) & 0x3f));
+		}
+		if (random() % 8)  {
+		    s += char(0x80 | (cp & 0x3f));
+		}
+		break;
+	    }
+	    default:
+		s += char(' ' + random() % 95);
+		break;
+	}
+    }
+
+    return s;
+}
+
+
+void AddLoadedObjects(std::vector<std::string> &paths)
+{
+    dl_iterate_phdr([](dl_phdr_info *info, size_t, void *data)  {
+	if (info->dlpi_name && *info->dlpi_name)  {
+	    static_cast<std::vector<std::string> *>(data)->push_back(info->dlpi_name);
+	}
+	return 0;
+    }, &paths);
+}
+
+
+template <typename F>
+double MegabytesPerSecond(const std::vector<std::string> &names, size_t bytes, F escape)
+{
+    std::string out;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < 10; ++pass)  {
+	for (auto &name: names)  {
+	    out.clear();
+	    escape(out, name);
+	    benchSink = out.size();
+	}
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+    return 10 * bytes / d.count() / 1e6;
+}
+
+
+int main(int argc, char **argv)
+{
+    std::mt19937 random(12345);
+    for (int i = 0; i < numFuzzStrings; ++i)  {
+	auto s = FuzzString(random);
+	std::string out;
+	JsonWriter::AppendJsonString(out, s);
+	if (out != ReferenceEscape(s))  {
+	    fprintf(stderr, "jsonEscapeBench: results differ for fuzz string %d\n", i);
+	    return 1;
+	}
+    }
+
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty())  {
+	paths.push_back("/proc/self/exe");
+	AddLoadedObjects(paths);
+    }
+
+    std::vector<std::string> names;
+    for (auto &path: paths)  {
+	ElfFile elf(path);
+	elf.SymbolNames(names);
+    }
+    for (size_t i = 0, n = names.size(); i < n; ++i)  {
+	int status;
+	if (auto demangled = abi::__cxa_demangle(names[i].c_str(), nullptr, nullptr, &status))  {
+	    names.push_back(demangled);
+	    free(demangled);
+	}
+    }
+
+    size_t bytes = 0;
+    for (auto &name: names)  {
+	std::string out;
+	JsonWriter::AppendJsonString(out, name);
+	if (out != ReferenceEscape(name))  {
+	    fprintf(stderr, "jsonEscapeBench: results differ for '%s'\n", name.c_str());
+	    return 1;
+	}
+	bytes += name.size();
+    }
+    if (names.empty())  {
+	fprintf(stderr, "jsonEscapeBench: no symbols found\n");
+	return 1;
+    }
+
+    double referenceMBs = 0, writerMBs = 0;
+    for (int run = 0; run < 5; ++run)  {
+	referenceMBs = std::max(referenceMBs, MegabytesPerSecond(names, bytes,
+		[](std::string &out, const std::string &s)  { out = ReferenceEscape(s); }));
+	writerMBs = std::max(writerMBs, MegabytesPerSecond(names, bytes,
+		[](std::string &out, const std::string &s)  { JsonWriter::AppendJsonString(out, s); }));
+    }
+
+    printf("jsonEscapeBench: %d fuzz strings identical, %zu names (%zu bytes) from %zu files\n",
+	    numFuzzStrings, names.size(), bytes, paths.size());
+    printf("  byte at a time    %8.1f MB/s\n", referenceMBs);
+    printf("  AppendJsonString  %8.1f MB/s  (%.1fx)\n", writerMBs, writerMBs / referenceMBs);
+
+    return 0;
+}
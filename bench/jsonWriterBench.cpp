@@ -0,0 +1,151 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Measures the throughput of JsonWriter writing call_analyzer's output for
+// a synthetic binary, indented and compact, to a stream that discards it.
+// The functions are shaped like those of a large C++ binary:  long mangled
+// names, 0-40 calls each with a few live registers and callee names.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <random>
+#include <streambuf>
+#include <vector>
+#include "../jsonWriter.h"
+#include "../registerMask.h"
+#include "../functionRecord.h"
+
+const size_t numFunctions = 100000;
+
+// results are stored here so the work is not optimized away
+volatile size_t benchSink;
+
+
+// Counts and discards everything written to it.
+class CountingStreambuf : public std::streambuf
+{
+    public:
+	size_t	count = 0;
+    protected:
+	int_type overflow(int_type c) override
+	{
+	    ++count;
+	    return traits_type::not_eof(c);
+	}
+	std::streamsize xsputn(const char *, std::streamsize n) override
+	{
+	    count += n;
+	    return n;
+	}
+};
+
+
+std::string RandomName(std::mt19937 &random)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+    std::uniform_int_distribution<int> length(6, 80);
+    std::uniform_int_distribution<int> c(0, sizeof chars - 2);
+
+    std::string name{"_ZN"};
+    for (int n = length(random); n > 0; --n)  {
+	name += chars[c(random)];
+    }
+
+    return name;
+}
+
+
+std::vector<FunctionRecord> MakeFunctions()
+{
+    auto names = std::make_shared<RecordNames>(std::vector<std::string>{
+	    "rdi", "rsi", "rdx", "rcx", "r8", "r9", "rax", "xmm0", "xmm1"});
+    std::mt19937 random(12345);
+    std::uniform_int_distribution<int> numCalls(0, 40);
+    std::uniform_int_distribution<int> numRegs(0, 6);
+    std::uniform_int_distribution<int> numNames(0, 2);
+
+    std::vector<FunctionRecord> funcs(numFunctions);
+    RecordAddress addr = 0x401000;
+    for (auto &f: funcs)  {
+	f.name = RandomName(random);
+	f.addr = addr;
+	f.section = ".text";
+	f.names = names;
+	for (int i = numCalls(random); i > 0; --i)  {
+	    CallRecord call;
+	    addr += random() % 64;
+	    call.callInsnAddr = addr;
+	    call.calledAddr = random() % 8 ? 0x401000 + random() % 0x1000000 : noRecordAddress;
+	    call.isToPlt = random() % 4 == 0;
+	    for (int r = numRegs(random); r > 0; --r)  {
+		call.liveRegs.Set(r);
+	    }
+	    for (int n = numNames(random); n > 0; --n)  {
+		call.funcNames.push_back(names->Add(RandomName(random)));
+	    }
+	    f.calls.push_back(std::move(call));
+	}
+	addr += random() % 256;
+    }
+
+    return funcs;
+}
+
+
+// Returns the throughput in MB/s and sets bytes to the size of the output.
+double MegabytesPerSecond(const std::vector<FunctionRecord> &funcs, int indent, size_t &bytes)
+{
+    CountingStreambuf counter;
+    std::ostream out(&counter);
+
+    auto start = std::chrono::steady_clock::now();
+    JsonWriter writer(out, indent);
+    writer.OpenObject();
+    writer.AddMemberKey("functions");
+    writer.OpenArray();
+    for (auto &f: funcs)  {
+	f.WriteJson(writer);
+    }
+    writer.CloseArray();
+    writer.CloseObject();
+    writer.End();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+    bytes = counter.count;
+    benchSink = bytes;
+
+    return bytes / d.count() / 1e6;
+}
+
+
+int main()
+{
+    auto funcs = MakeFunctions();
+
+    size_t indentedBytes, compactBytes;
+    double indentedMBs = 0, compactMBs = 0;
+    for (int run = 0; run < 5; ++run)  {
+	indentedMBs = std::max(indentedMBs, MegabytesPerSecond(funcs, 2, indentedBytes));
+	compactMBs = std::max(compactMBs, MegabytesPerSecond(funcs, 0, compactBytes));
+    }
+
+    printf("jsonWriterBench: %zu functions\n", numFunctions);
+    printf("  indented  %8.1f MB/s  (%zu bytes)\n", indentedMBs, indentedBytes);
+    printf("  compact   %8.1f MB/s  (%zu bytes)\n", compactMBs, compactBytes);
+
+    return 0;
+}
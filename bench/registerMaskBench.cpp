@@ -0,0 +1,166 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Compares the per-instruction cost of collecting the registers used by an
+// instruction into a register set, and the per-block cost of computing a
+// block's out registers, using a heap allocated bitArray (as call_analyzer
+// did) and an inline RegisterMask.  The register indices are a random
+// stream shaped like x86_64 code:  1-4 registers per instruction, mostly
+// general purpose registers.  Neither path includes the std::set of
+// registers InstructionAPI fills for each instruction, which call_analyzer
+// still allocates, so this is only the cost of collecting them.
+
+#include <boost/dynamic_bitset.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "../registerMask.h"
+
+using bitArray = boost::dynamic_bitset<>;
+
+const size_t abiRegisters = 300;	// approximate size of the x86_64 ABI index map
+const size_t numInstructions = 1 << 22;
+const size_t instructionsPerBlock = 6;
+
+// results are stored here so the work is not optimized away
+volatile size_t benchSink;
+
+
+struct Instruction
+{
+    int		numRegs;
+    int		regs[4];
+};
+
+
+std::vector<Instruction> MakeInstructions()
+{
+    std::mt19937 random(12345);
+    std::uniform_int_distribution<int> numRegs(1, 4);
+    std::uniform_int_distribution<int> gpr(0, 20);
+    std::uniform_int_distribution<int> other(0, abiRegisters - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    std::vector<Instruction> insns(numInstructions);
+    for (auto &insn: insns)  {
+	insn.numRegs = numRegs(random);
+	for (int i = 0; i < insn.numRegs; ++i)  {
+	    insn.regs[i] = percent(random) < 85 ? gpr(random) : other(random);
+	}
+    }
+
+    return insns;
+}
+
+
+template <typename F>
+double NanosecondsPerInstruction(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    benchSink = f();
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+
+    return d.count() / numInstructions;
+}
+
+
+// The previous path:  a new bitArray per instruction ORed into the block's
+// used registers, and copies of bitArrays to compute the out registers.
+size_t BitArrayPath(const std::vector<Instruction> &insns)
+{
+    bitArray notKilled(abiRegisters), returnRegs(abiRegisters), start(abiRegisters);
+    notKilled[3] = notKilled[4] = notKilled[5] = 1;
+    returnRegs[0] = returnRegs[2] = 1;
+
+    size_t count = 0;
+    bitArray used(abiRegisters);
+    for (size_t i = 0; i < insns.size(); ++i)  {
+	bitArray insnRegs(abiRegisters);
+	for (int r = 0; r < insns[i].numRegs; ++r)  {
+	    insnRegs[insns[i].regs[r]] = 1;
+	}
+	used |= insnRegs;
+
+	if (i % instructionsPerBlock == instructionsPerBlock - 1)  {
+	    bitArray out{used};
+	    out |= start;
+	    out &= notKilled;
+	    out |= returnRegs;
+	    count += out.count();
+	    used = bitArray(abiRegisters);
+	}
+    }
+
+    return count;
+}
+
+
+size_t RegisterMaskPath(const std::vector<Instruction> &insns)
+{
+    RegisterMask notKilled, returnRegs, start;
+    notKilled.Set(3);
+    notKilled.Set(4);
+    notKilled.Set(5);
+    returnRegs.Set(0);
+    returnRegs.Set(2);
+
+    size_t count = 0;
+    RegisterMask used;
+    for (size_t i = 0; i < insns.size(); ++i)  {
+	RegisterMask insnRegs;
+	for (int r = 0; r < insns[i].numRegs; ++r)  {
+	    insnRegs.Set(insns[i].regs[r]);
+	}
+	used |= insnRegs;
+
+	if (i % instructionsPerBlock == instructionsPerBlock - 1)  {
+	    RegisterMask out{used};
+	    out |= start;
+	    out &= notKilled;
+	    out |= returnRegs;
+	    count += out.Count();
+	    used = RegisterMask{};
+	}
+    }
+
+    return count;
+}
+
+
+int main()
+{
+    auto insns = MakeInstructions();
+
+    // warm up, and check both paths compute the same sets
+    auto expected = BitArrayPath(insns);
+    if (RegisterMaskPath(insns) != expected)  {
+	fprintf(stderr, "registerMaskBench: results differ\n");
+	return 1;
+    }
+
+    double bitArrayNs = 1e30, maskNs = 1e30;
+    for (int run = 0; run < 5; ++run)  {
+	bitArrayNs = std::min(bitArrayNs, NanosecondsPerInstruction([&]  { return BitArrayPath(insns); }));
+	maskNs = std::min(maskNs, NanosecondsPerInstruction([&]  { return RegisterMaskPath(insns); }));
+    }
+
+    printf("registerMaskBench: %zu instructions, %zu registers\n", numInstructions, abiRegisters);
+    printf("  bitArray      %8.2f ns/instruction\n", bitArrayNs);
+    printf("  RegisterMask  %8.2f ns/instruction  (%.1fx)\n", maskNs, bitArrayNs / maskNs);
+
+    return 0;
+}
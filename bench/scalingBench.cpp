@@ -0,0 +1,661 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Measures call_analyzer end to end on a corpus of synthetic C programs
+// that are generated and compiled locally, from a few functions to hundreds
+// of thousands.  The programs have different shapes:  many small functions
+// calling each other, deeply nested control flow, big switches (jump
+// tables), and many calls through the PLT.  Each program is analyzed with
+// --stats, and its throughput, peak memory and phase times are written to a
+// results file, one tab separated line per program, that later runs can be
+// compared against with --baseline.
+//
+// The corpus is generated deterministically, and a program is only
+// regenerated and rebuilt when its parameters or the generator change.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+// change when the generated code changes, so the corpus is rebuilt
+const int generatorVersion = 1;
+
+const size_t functionsPerFile = 1000;
+
+
+enum class Shape
+{
+    flat,		// small functions calling each other
+    deep,		// deeply nested ifs and loops
+    switches,		// a big switch in each function
+    plt,		// many calls to libc through the PLT
+    mixed		// all of the above, in turn
+};
+
+
+struct Program
+{
+    const char	*name;
+    Shape	shape;
+    size_t	numFunctions;
+    int		size;		// calls, depth, cases or libc calls per function
+    bool	large;		// skipped with --quick
+};
+
+
+const Program programs[] = {
+    {"flat-10",		Shape::flat,		10,	3,	false},
+    {"flat-1k",		Shape::flat,		1000,	3,	false},
+    {"flat-20k",	Shape::flat,		20000,	3,	false},
+    {"deep-2k",		Shape::deep,		2000,	48,	false},
+    {"switch-2k",	Shape::switches,	2000,	256,	false},
+    {"plt-20k",		Shape::plt,		20000,	12,	false},
+    {"flat-200k",	Shape::flat,		200000,	3,	true},
+    {"mixed-300k",	Shape::mixed,		300000,	8,	true},
+};
+
+
+struct Settings
+{
+    std::string			analyzer{"./call_analyzer"};
+    std::string			corpus{"bench/corpus"};
+    std::string			results{"bench/results.tsv"};
+    std::string			baseline;
+    std::string			cc;
+    std::string			cflags{"-O2 -fno-inline -w"};
+    std::vector<std::string>	analyzerArgs;
+    std::set<std::string>	only;
+    unsigned			jobs = 1;
+    unsigned			repeat = 1;
+    double			maxSlowdown = -1;
+    bool			quick = false;
+};
+
+
+// A measured run of call_analyzer on a program.
+struct Result
+{
+    std::string			program;
+    std::map<std::string, double>	values;
+};
+
+
+// The columns of the results file after the program name, in order.
+const char *const columns[] = {
+    "functions", "blocks", "instructions", "callSites",
+    "seconds", "functionsPerSecond", "instructionsPerSecond", "peakRssMiB",
+    "symtabLoad", "parse", "summarize",
+    "summarizeBlocks", "addParamRegs", "propagateStartRegs", "write",
+};
+
+
+const char *ShapeName(Shape s)
+{
+    switch (s)  {
+	case Shape::flat:
+	    return "flat";
+	case Shape::deep:
+	    return "deep";
+	case Shape::switches:
+	    return "switch";
+	case Shape::plt:
+	    return "plt";
+	case Shape::mixed:
+	    return "mixed";
+    }
+
+    return "";
+}
+
+
+std::string Quote(const std::string &s)
+{
+    std::string q{"'"};
+    for (auto c: s)  {
+	if (c == '\'')  {
+	    q += "'\\''";
+	}  else  {
+	    q += c;
+	}
+    }
+
+    return q + "'";
+}
+
+
+bool ReadFile(const std::string &path, std::string &contents)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)  {
+	return false;
+    }
+    std::ostringstream s;
+    s << f.rdbuf();
+    contents = s.str();
+
+    return true;
+}
+
+
+// Writes the C source of a program, split into files of functionsPerFile
+// functions, and a Makefile to build it.
+class CorpusGenerator
+{
+    public:
+	CorpusGenerator(const Program &p)
+	    : program(p), random(std::hash<std::string>{}(p.name) ^ generatorVersion)
+	    {}
+	void Write(const std::string &dir);
+    private:
+	void		Function(Shape shape);
+	void		Flat();
+	void		Deep();
+	void		Switch();
+	void		Plt();
+	std::string	Call(const std::string &args);
+	unsigned	Constant()
+	{
+	    return random() % 1000 + 1;
+	}
+
+	const Program		&program;
+	std::mt19937		random;
+	std::ostringstream	body;
+	std::set<size_t>	callees;
+};
+
+
+void CorpusGenerator::Write(const std::string &dir)
+{
+    std::vector<std::string> objects{"main.o"};
+    std::ofstream main(dir + "/main.c");
+    main << "long f0(long, long);\n\n"
+	<< "int main(int argc, char **argv)\n{\n"
+	<< "    return argc > 1000 ? (int)f0(argc, (long)argv) : 0;\n}\n";
+
+    for (size_t first = 0; first < program.numFunctions; first += functionsPerFile)  {
+	auto name = "f" + std::to_string(first / functionsPerFile);
+	objects.push_back(name + ".o");
+	std::ofstream out(dir + "/" + name + ".c");
+	out << "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n\n"
+	    << "static char buf[64];\n\n";
+	auto last = std::min(program.numFunctions, first + functionsPerFile);
+	for (auto i = first; i < last; ++i)  {
+	    body.str("");
+	    callees.clear();
+	    auto shape = program.shape;
+	    if (shape == Shape::mixed)  {
+		shape = Shape(i % 4);
+	    }
+	    Function(shape);
+	    for (auto c: callees)  {
+		out << "long f" << c << "(long, long);\n";
+	    }
+	    out << "\nlong f" << i << "(long a, long b)\n{\n    long r = a ^ b;\n"
+		<< body.str() << "    return r;\n}\n\n";
+	}
+    }
+
+    std::ofstream makefile(dir + "/Makefile");
+    makefile << "CC = cc\nCFLAGS = -O2\nOBJS =";
+    for (auto &o: objects)  {
+	makefile << " \\\n\t" << o;
+    }
+    makefile << "\n\nprog: $(OBJS)\n\t$(CC) -o $@ $(OBJS)\n";
+}
+
+
+void CorpusGenerator::Function(Shape shape)
+{
+    switch (shape)  {
+	case Shape::flat:
+	    Flat();
+	    break;
+	case Shape::deep:
+	    Deep();
+	    break;
+	case Shape::switches:
+	    Switch();
+	    break;
+	case Shape::plt:
+	case Shape::mixed:
+	    Plt();
+	    break;
+    }
+}
+
+
+// Returns a call to a random function, which may be itself or one that
+// calls it, so the call graph has cycles.
+std::string CorpusGenerator::Call(const std::string &args)
+{
+    auto c = random() % program.numFunctions;
+    callees.insert(c);
+
+    return "f" + std::to_string(c) + "(" + args + ")";
+}
+
+
+void CorpusGenerator::Flat()
+{
+    body << "    r = r * " << Constant() << " + b;\n";
+    for (int c = 0; c < program.size; ++c)  {
+	body << "    if (r & " << (1 << (random() % 8)) << ")\n"
+	    << "\tr += " << Call("r, b + " + std::to_string(c)) << ";\n";
+    }
+}
+
+
+// Nested ifs and loops, each level inside the previous one, with a call at
+// every eighth level and an else branch on some of the ifs.
+void CorpusGenerator::Deep()
+{
+    auto depth = program.size;
+    std::vector<bool> isIf(depth);
+    auto indent = [](int d)  {
+	return std::string(std::min(4 * (d + 1), 40), ' ');
+    };
+
+    for (int d = 0; d < depth; ++d)  {
+	switch (random() % 3)  {
+	    case 0:
+		isIf[d] = true;
+		body << indent(d) << "if ((r ^ b) & " << (1 << (random() % 16)) << ")  {\n"
+		    << indent(d) << "    r = r * " << Constant() << " + " << d << ";\n";
+		break;
+	    case 1:
+		body << indent(d) << "for (long i" << d << " = 0; i" << d << " < (b & 7); ++i" << d << ")  {\n"
+		    << indent(d) << "    r += i" << d << " * " << Constant() << ";\n";
+		break;
+	    default:
+		body << indent(d) << "while (r > " << Constant() << ")  {\n"
+		    << indent(d) << "    r >>= 1;\n";
+		break;
+	}
+	if (d % 8 == 7)  {
+	    body << indent(d) << "    r ^= " << Call("r, b") << ";\n";
+	}
+    }
+    for (int d = depth - 1; d >= 0; --d)  {
+	body << indent(d) << "}";
+	if (isIf[d] && d % 2 == 0)  {
+	    body << "  else  {\n" << indent(d) << "    r -= " << Constant() << ";\n" << indent(d) << "}";
+	}
+	body << '\n';
+    }
+}
+
+
+// A switch over contiguous cases, compiled to a jump table.
+void CorpusGenerator::Switch()
+{
+    body << "    switch ((unsigned long)a % " << program.size << ")  {\n";
+    for (int c = 0; c < program.size; ++c)  {
+	body << "\tcase " << c << ":\n"
+	    << "\t    r = r * " << Constant() << " + b;\n";
+	if (c % 16 == 0)  {
+	    body << "\t    r += " << Call("r, b") << ";\n";
+	}
+	body << "\t    break;\n";
+    }
+    body << "\tdefault:\n\t    r = -r;\n    }\n";
+}
+
+
+// Calls to libc functions, which go through the PLT.
+void CorpusGenerator::Plt()
+{
+    static const char *const calls[] = {
+	"    r += strlen(buf + (r & 15));\n",
+	"    memset(buf, (int)r, b & 31);\n",
+	"    r ^= atoi(buf);\n",
+	"    if (r == b)\n\tputs(buf);\n",
+	"    free(malloc(r & 255));\n",
+	"    r += strcmp(buf, buf + (b & 7));\n",
+	"    memcpy(buf + 16, buf, b & 15);\n",
+	"    r += getenv(buf) != 0;\n",
+	"    snprintf(buf, sizeof buf, \"%ld\", r);\n",
+	"    r += strtol(buf, 0, 10);\n",
+	"    r ^= strchr(buf, (int)b) != 0;\n",
+	"    r += abs((int)r);\n",
+    };
+    const size_t numCalls = sizeof calls / sizeof calls[0];
+
+    for (int c = 0; c < program.size; ++c)  {
+	body << calls[random() % numCalls];
+    }
+    body << "    r += " << Call("r, b") << ";\n";
+}
+
+
+// Generates and builds the program in its directory under the corpus,
+// unless it is already built with the same parameters.  Returns the path
+// of the program, or "" if it could not be built.
+std::string BuildProgram(const Program &p, const Settings &settings)
+{
+    auto dir = settings.corpus + "/" + p.name;
+    auto prog = dir + "/prog";
+
+    std::ostringstream params;
+    params << "generator " << generatorVersion << " shape " << ShapeName(p.shape)
+	<< " functions " << p.numFunctions << " size " << p.size
+	<< " cc " << settings.cc << " cflags " << settings.cflags << '\n';
+    std::string oldParams;
+    struct stat st;
+    if (ReadFile(dir + "/params", oldParams) && oldParams == params.str()
+	    && stat(prog.c_str(), &st) == 0)  {
+	return prog;
+    }
+
+    std::cout << p.name << ": generating and building " << p.numFunctions << " functions" << std::endl;
+    auto command = "rm -rf " + Quote(dir) + " && mkdir -p " + Quote(dir);
+    if (std::system(command.c_str()))  {
+	return "";
+    }
+    CorpusGenerator(p).Write(dir);
+
+    command = "make -s -C " + Quote(dir) + " -j" + std::to_string(std::thread::hardware_concurrency())
+	    + " CC=" + Quote(settings.cc) + " CFLAGS=" + Quote(settings.cflags) + " prog";
+    if (std::system(command.c_str()))  {
+	return "";
+    }
+    std::ofstream(dir + "/params") << params.str();
+
+    return prog;
+}
+
+
+// Returns the number found by following the keys, in order, through the
+// --stats JSON, or -1 if it is not there.
+double StatsValue(const std::string &json, std::initializer_list<const char *> keys)
+{
+    size_t pos = 0;
+    for (auto k: keys)  {
+	pos = json.find(std::string{"\""} + k + "\":", pos);
+	if (pos == json.npos)  {
+	    return -1;
+	}
+	pos += strlen(k) + 3;
+    }
+
+    return strtod(json.c_str() + pos, nullptr);
+}
+
+
+// Analyzes the program settings.repeat times, keeping the fastest run.
+// Returns false if call_analyzer failed.
+bool Measure(const Program &p, const std::string &prog, const Settings &settings, Result &result)
+{
+    auto statsPath = settings.corpus + "/" + p.name + "/stats.json";
+    std::string command = Quote(settings.analyzer) + " --jobs " + std::to_string(settings.jobs)
+	    + " --stats=" + Quote(statsPath);
+    for (auto &a: settings.analyzerArgs)  {
+	command += " " + Quote(a);
+    }
+    command += " " + Quote(prog) + " /dev/null";
+
+    result.program = p.name;
+    result.values.clear();
+    for (unsigned run = 0; run < settings.repeat; ++run)  {
+	std::string stats;
+	if (std::system(command.c_str()) || !ReadFile(statsPath, stats))  {
+	    return false;
+	}
+	auto seconds = StatsValue(stats, {"phases", "total", "wallSeconds"});
+	if (!result.values.empty() && seconds >= result.values["seconds"])  {
+	    continue;
+	}
+
+	auto &v = result.values;
+	v["functions"] = StatsValue(stats, {"counters", "functions"});
+	v["blocks"] = StatsValue(stats, {"counters", "blocks"});
+	v["instructions"] = StatsValue(stats, {"counters", "instructions"});
+	v["callSites"] = StatsValue(stats, {"counters", "callSites"});
+	v["seconds"] = seconds;
+	v["functionsPerSecond"] = seconds > 0 ? v["functions"] / seconds : 0;
+	v["instructionsPerSecond"] = seconds > 0 ? v["instructions"] / seconds : 0;
+	v["peakRssMiB"] = StatsValue(stats, {"counters", "peakRssBytes"}) / (1 << 20);
+	for (auto phase: {"symtabLoad", "parse", "summarize", "summarizeBlocks",
+		    "addParamRegs", "propagateStartRegs", "write"})  {
+	    v[phase] = StatsValue(stats, {"phases", phase, "wallSeconds"});
+	}
+    }
+
+    return true;
+}
+
+
+void WriteResults(std::ostream &out, const std::vector<Result> &results, const Settings &settings)
+{
+    out << "# call_analyzer scaling benchmark: --jobs " << settings.jobs;
+    for (auto &a: settings.analyzerArgs)  {
+	out << ' ' << a;
+    }
+    out << ", best of " << settings.repeat << ", cc " << settings.cc << ' ' << settings.cflags << '\n';
+
+    out << "program";
+    for (auto c: columns)  {
+	out << '\t' << c;
+    }
+    out << '\n';
+    for (auto &r: results)  {
+	out << r.program;
+	for (auto c: columns)  {
+	    out << '\t' << r.values.at(c);
+	}
+	out << '\n';
+    }
+}
+
+
+// Reads a results file into a map from program name to its values.
+bool ReadResults(const std::string &path, std::map<std::string, Result> &results)
+{
+    std::ifstream in(path);
+    if (!in)  {
+	return false;
+    }
+
+    std::vector<std::string> header;
+    std::string line;
+    while (getline(in, line))  {
+	if (line.empty() || line[0] == '#')  {
+	    continue;
+	}
+	std::vector<std::string> fields;
+	std::istringstream s(line);
+	std::string field;
+	while (getline(s, field, '\t'))  {
+	    fields.push_back(field);
+	}
+	if (header.empty())  {
+	    header = fields;
+	    continue;
+	}
+	auto &r = results[fields[0]];
+	r.program = fields[0];
+	for (size_t i = 1; i < fields.size() && i < header.size(); ++i)  {
+	    r.values[header[i]] = strtod(fields[i].c_str(), nullptr);
+	}
+    }
+
+    return true;
+}
+
+
+// Prints the change of each program from the baseline.  Returns the number
+// of programs slower than settings.maxSlowdown percent.
+int Compare(const std::vector<Result> &results, const std::map<std::string, Result> &baseline,
+	const Settings &settings)
+{
+    int numSlower = 0;
+    std::printf("\n%-12s %21s %25s %21s\n", "vs baseline", "seconds", "functions/s", "peak MiB");
+    for (auto &r: results)  {
+	auto b = baseline.find(r.program);
+	if (b == baseline.end())  {
+	    std::printf("%-12s (not in baseline)\n", r.program.c_str());
+	    continue;
+	}
+	auto change = [&](const char *column)  {
+	    auto i = b->second.values.find(column);
+	    if (i == b->second.values.end() || i->second <= 0)  {
+		return 0.0;
+	    }
+	    return (r.values.at(column) / i->second - 1) * 100;
+	};
+	auto &bv = b->second.values;
+	auto slowdown = change("seconds");
+	bool slower = settings.maxSlowdown >= 0 && slowdown > settings.maxSlowdown;
+	numSlower += slower;
+	std::printf("%-12s %8.3f -> %8.3f %+6.1f%% %9.0f -> %9.0f %+6.1f%% %7.1f -> %7.1f %+6.1f%%%s\n",
+		r.program.c_str(),
+		bv.count("seconds") ? bv.at("seconds") : 0, r.values.at("seconds"), slowdown,
+		bv.count("functionsPerSecond") ? bv.at("functionsPerSecond") : 0,
+		r.values.at("functionsPerSecond"), change("functionsPerSecond"),
+		bv.count("peakRssMiB") ? bv.at("peakRssMiB") : 0, r.values.at("peakRssMiB"),
+		change("peakRssMiB"), slower ? "  SLOWER" : "");
+    }
+
+    return numSlower;
+}
+
+
+void Usage(const char *programName)
+{
+    std::clog << "Usage: " << programName << " [options] [-- call_analyzer options]\n"
+	<< "  --analyzer PATH  call_analyzer to measure (default ./call_analyzer)\n"
+	<< "  --corpus DIR     where the programs are generated (default bench/corpus)\n"
+	<< "  --results FILE   write the results to FILE (default bench/results.tsv)\n"
+	<< "  --baseline FILE  compare the results to an earlier results file\n"
+	<< "  --max-slowdown PCT\n"
+	<< "                   fail if a program is PCT percent slower than the baseline\n"
+	<< "  --programs LIST  only the comma separated programs in LIST\n"
+	<< "  --quick          skip the programs of more than 100,000 functions\n"
+	<< "  --jobs N         run call_analyzer with --jobs N (default 1)\n"
+	<< "  --repeat N       keep the fastest of N runs (default 1)\n"
+	<< "  --cc CC          C compiler (default $CC or cc)\n"
+	<< "  --cflags FLAGS   C compiler flags (default -O2 -fno-inline -w)\n"
+	<< "programs:";
+    for (auto &p: programs)  {
+	std::clog << ' ' << p.name;
+    }
+    std::clog << '\n';
+}
+
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+
+    Settings settings;
+    settings.cc = getenv("CC") ? getenv("CC") : "cc";
+
+    for (int i = 1; i < argc; ++i)  {
+	string arg = argv[i];
+	auto value = [&]()  {
+	    if (i + 1 >= argc)  {
+		Usage(argv[0]);
+		exit(1);
+	    }
+	    return string{argv[++i]};
+	};
+	if (arg == "--analyzer")  {
+	    settings.analyzer = value();
+	}  else if (arg == "--corpus")  {
+	    settings.corpus = value();
+	}  else if (arg == "--results")  {
+	    settings.results = value();
+	}  else if (arg == "--baseline")  {
+	    settings.baseline = value();
+	}  else if (arg == "--max-slowdown")  {
+	    settings.maxSlowdown = strtod(value().c_str(), nullptr);
+	}  else if (arg == "--programs")  {
+	    istringstream s(value());
+	    string name;
+	    while (getline(s, name, ','))  {
+		settings.only.insert(name);
+	    }
+	}  else if (arg == "--quick")  {
+	    settings.quick = true;
+	}  else if (arg == "--jobs")  {
+	    settings.jobs = strtoul(value().c_str(), nullptr, 10);
+	}  else if (arg == "--repeat")  {
+	    settings.repeat = max(1ul, strtoul(value().c_str(), nullptr, 10));
+	}  else if (arg == "--cc")  {
+	    settings.cc = value();
+	}  else if (arg == "--cflags")  {
+	    settings.cflags = value();
+	}  else if (arg == "--")  {
+	    settings.analyzerArgs.assign(argv + i + 1, argv + argc);
+	    break;
+	}  else  {
+	    Usage(argv[0]);
+	    return arg == "--help" ? 0 : 1;
+	}
+    }
+
+    map<string, Result> baseline;
+    if (!settings.baseline.empty() && !ReadResults(settings.baseline, baseline))  {
+	clog << argv[0] << ": unable to read baseline '" << settings.baseline << "'\n";
+	return 1;
+    }
+
+    vector<Result> results;
+    for (auto &p: programs)  {
+	if (settings.only.empty() ? settings.quick && p.large : !settings.only.count(p.name))  {
+	    continue;
+	}
+	auto prog = BuildProgram(p, settings);
+	if (prog.empty())  {
+	    clog << argv[0] << ": unable to build " << p.name << '\n';
+	    return 1;
+	}
+	Result r;
+	if (!Measure(p, prog, settings, r))  {
+	    clog << argv[0] << ": " << settings.analyzer << " failed on " << prog << '\n';
+	    return 1;
+	}
+	auto &v = r.values;
+	printf("%-12s %7.0f functions %9.0f instructions %8.3fs %9.0f functions/s %11.0f instructions/s %7.1f MiB\n",
+		p.name, v["functions"], v["instructions"], v["seconds"], v["functionsPerSecond"],
+		v["instructionsPerSecond"], v["peakRssMiB"]);
+	fflush(stdout);
+	results.push_back(move(r));
+    }
+
+    ofstream out(settings.results);
+    WriteResults(out, results, settings);
+    if (!out.flush())  {
+	clog << argv[0] << ": unable to write '" << settings.results << "'\n";
+	return 1;
+    }
+
+    if (!settings.baseline.empty() && Compare(results, baseline, settings) > 0)  {
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,451 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// An index of a binary's call sites that is memory mapped to answer queries
+// without reading the output.  Requires functionRecord.h.
+//
+// The file is a Header followed by tables of fixed size entries, each
+// aligned to 8 bytes, in the host's byte order:
+//
+//	strings		NUL terminated strings, referred to by their offset
+//	functions	FunctionEntry sorted by entry address
+//	calls		CallEntry grouped by function, in output order
+//	callNames	string offsets of the callee names of the calls
+//	callees		CalleeEntry sorted by name (strcmp order)
+//	postings	call indices of each callee, in call order
+//	callsByAddr	call indices sorted by call instruction address
+//	funcsByName	function indices sorted by name (strcmp order)
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+struct CallIndexFormat
+{
+    static const uint32_t	version = 1;
+    static const uint32_t	byteOrder = 0x01020304;
+
+    struct Table
+    {
+	uint64_t	offset;
+	uint64_t	count;
+    };
+
+    struct Header
+    {
+	char		magic[8];		// "CAINDEX\0"
+	uint32_t	version;
+	uint32_t	byteOrder;
+	uint64_t	fileSize;
+	Table		strings;
+	Table		functions;
+	Table		calls;
+	Table		callNames;
+	Table		callees;
+	Table		postings;
+	Table		callsByAddr;
+	Table		funcsByName;
+    };
+
+    struct FunctionEntry
+    {
+	uint64_t	entry;
+	uint64_t	addr;			// FunctionRecord::addr
+	uint32_t	name;
+	uint32_t	section;
+	uint32_t	firstCall;
+	uint32_t	numCalls;
+	uint32_t	isInPlt;
+	uint32_t	pad;
+    };
+
+    struct CallEntry
+    {
+	uint64_t	callInsnAddr;
+	uint64_t	calledAddr;
+	uint32_t	function;
+	uint32_t	liveRegs;		// the names separated by commas
+	uint32_t	firstName;
+	uint16_t	numNames;
+	uint8_t		isToPlt;
+	uint8_t		pad;
+    };
+
+    struct CalleeEntry
+    {
+	uint32_t	name;
+	uint32_t	firstPosting;
+	uint32_t	numPostings;
+    };
+};
+
+
+// Collects the function records as they are written, then writes the index.
+class CallIndexWriter
+{
+    public:
+	void Add(const FunctionRecord &f, RecordAddress entry);
+	void Write(const std::string &path) const;
+    private:
+	using F = CallIndexFormat;
+
+	uint32_t	String(const std::string &s);
+
+	std::string				strings{'\0'};
+	std::unordered_map<std::string, uint32_t>	stringOffsets;
+	std::vector<F::FunctionEntry>		functions;
+	std::vector<F::CallEntry>		calls;
+	std::vector<uint32_t>			callNames;
+};
+
+
+// A memory mapped index.  Open throws std::runtime_error if the file is not
+// a valid index.
+class CallIndex
+{
+    public:
+	using F = CallIndexFormat;
+
+	CallIndex(const std::string &path);
+	~CallIndex();
+	CallIndex(const CallIndex &) = delete;
+	CallIndex &operator=(const CallIndex &) = delete;
+
+	const char *String(uint32_t offset) const
+	{
+	    return strings + offset;
+	}
+	size_t NumFunctions() const
+	{
+	    return header->functions.count;
+	}
+	const F::FunctionEntry &Function(uint32_t i) const
+	{
+	    return functions[i];
+	}
+	const F::CallEntry &Call(uint32_t i) const
+	{
+	    return calls[i];
+	}
+	const uint32_t *CallNames(const F::CallEntry &c) const
+	{
+	    return callNames + c.firstName;
+	}
+	std::vector<uint32_t> CallsTo(std::string_view callee) const;
+	std::vector<uint32_t> CallsFrom(std::string_view caller) const;
+	std::vector<uint32_t> CallsInRange(uint64_t start, uint64_t end) const;
+	const F::FunctionEntry *FunctionAt(uint64_t addr) const;
+    private:
+	template <typename T>
+	const T		*Table(const F::Table &t) const;
+
+	void			*map = MAP_FAILED;
+	size_t			mapSize = 0;
+	const F::Header		*header;
+	const char		*strings;
+	const F::FunctionEntry	*functions;
+	const F::CallEntry	*calls;
+	const uint32_t		*callNames;
+	const F::CalleeEntry	*callees;
+	const uint32_t		*postings;
+	const uint32_t		*callsByAddr;
+	const uint32_t		*funcsByName;
+};
+
+
+void CallIndexWriter::Add(const FunctionRecord &f, RecordAddress entry)
+{
+    F::FunctionEntry fe{};
+    fe.entry = entry;
+    fe.addr = f.addr;
+    fe.name = String(f.name);
+    fe.section = String(f.section);
+    fe.firstCall = calls.size();
+    fe.numCalls = f.calls.size();
+    fe.isInPlt = f.isInPlt;
+
+    for (auto &call: f.calls)  {
+	std::string regs;
+	auto &regMask = call.liveRegs;
+	for (auto i = regMask.FindFirst(); i < regMask.numBits; i = regMask.FindNext(i))  {
+	    if (!regs.empty())  {
+		regs += ',';
+	    }
+	    regs += f.names->Register(i);
+	}
+
+	F::CallEntry ce{};
+	ce.callInsnAddr = call.callInsnAddr;
+	ce.calledAddr = call.calledAddr;
+	ce.function = functions.size();
+	ce.liveRegs = String(regs);
+	ce.firstName = callNames.size();
+	ce.numNames = std::min<size_t>(call.funcNames.size(), UINT16_MAX);
+	ce.isToPlt = call.isToPlt;
+	for (size_t i = 0; i < ce.numNames; ++i)  {
+	    callNames.push_back(String(f.names->Name(call.funcNames[i])));
+	}
+	calls.push_back(ce);
+    }
+
+    functions.push_back(fe);
+    if (strings.size() > UINT32_MAX || calls.size() > UINT32_MAX || callNames.size() > UINT32_MAX)  {
+	throw std::runtime_error{"too many call sites for the index"};
+    }
+}
+
+
+uint32_t CallIndexWriter::String(const std::string &s)
+{
+    auto i = stringOffsets.emplace(s, strings.size());
+    if (i.second)  {
+	strings.append(s.c_str(), s.size() + 1);
+    }
+
+    return i.first->second;
+}
+
+
+void CallIndexWriter::Write(const std::string &path) const
+{
+    using namespace std;
+
+    // the functions are sorted by entry, so the calls are renumbered
+    vector<uint32_t> funcOrder(functions.size());
+    for (uint32_t i = 0; i < funcOrder.size(); ++i)  {
+	funcOrder[i] = i;
+    }
+    stable_sort(funcOrder.begin(), funcOrder.end(), [&](uint32_t a, uint32_t b)  {
+	return functions[a].entry < functions[b].entry;
+    });
+    vector<uint32_t> newFuncIndex(functions.size());
+    vector<F::FunctionEntry> sortedFuncs;
+    vector<F::CallEntry> sortedCalls;
+    for (auto i: funcOrder)  {
+	newFuncIndex[i] = sortedFuncs.size();
+	auto fe = functions[i];
+	fe.firstCall = sortedCalls.size();
+	sortedCalls.insert(sortedCalls.end(), calls.begin() + functions[i].firstCall,
+		calls.begin() + functions[i].firstCall + fe.numCalls);
+	sortedFuncs.push_back(fe);
+    }
+    for (auto &c: sortedCalls)  {
+	c.function = newFuncIndex[c.function];
+    }
+
+    // callee name -> calls, in call order
+    map<string_view, vector<uint32_t>> byCallee;
+    for (uint32_t i = 0; i < sortedCalls.size(); ++i)  {
+	auto &c = sortedCalls[i];
+	for (uint32_t j = 0; j < c.numNames; ++j)  {
+	    auto &calls = byCallee[strings.c_str() + callNames[c.firstName + j]];
+	    if (calls.empty() || calls.back() != i)  {
+		calls.push_back(i);
+	    }
+	}
+    }
+    vector<F::CalleeEntry> callees;
+    vector<uint32_t> postings;
+    for (auto &c: byCallee)  {
+	callees.push_back({uint32_t(c.first.data() - strings.c_str()), uint32_t(postings.size()),
+		uint32_t(c.second.size())});
+	postings.insert(postings.end(), c.second.begin(), c.second.end());
+    }
+
+    vector<uint32_t> callsByAddr(sortedCalls.size());
+    for (uint32_t i = 0; i < callsByAddr.size(); ++i)  {
+	callsByAddr[i] = i;
+    }
+    stable_sort(callsByAddr.begin(), callsByAddr.end(), [&](uint32_t a, uint32_t b)  {
+	return sortedCalls[a].callInsnAddr < sortedCalls[b].callInsnAddr;
+    });
+
+    vector<uint32_t> funcsByName(sortedFuncs.size());
+    for (uint32_t i = 0; i < funcsByName.size(); ++i)  {
+	funcsByName[i] = i;
+    }
+    stable_sort(funcsByName.begin(), funcsByName.end(), [&](uint32_t a, uint32_t b)  {
+	return strcmp(strings.c_str() + sortedFuncs[a].name, strings.c_str() + sortedFuncs[b].name) < 0;
+    });
+
+    F::Header header{};
+    memcpy(header.magic, "CAINDEX", 8);
+    header.version = F::version;
+    header.byteOrder = F::byteOrder;
+
+    string data;
+    auto addTable = [&](F::Table &t, const void *p, size_t size, size_t count)  {
+	data.resize((data.size() + 7) & ~size_t(7));
+	t.offset = sizeof header + data.size();
+	t.count = count;
+	data.append(static_cast<const char *>(p), size * count);
+    };
+    addTable(header.strings, strings.data(), 1, strings.size());
+    addTable(header.functions, sortedFuncs.data(), sizeof(F::FunctionEntry), sortedFuncs.size());
+    addTable(header.calls, sortedCalls.data(), sizeof(F::CallEntry), sortedCalls.size());
+    addTable(header.callNames, callNames.data(), sizeof(uint32_t), callNames.size());
+    addTable(header.callees, callees.data(), sizeof(F::CalleeEntry), callees.size());
+    addTable(header.postings, postings.data(), sizeof(uint32_t), postings.size());
+    addTable(header.callsByAddr, callsByAddr.data(), sizeof(uint32_t), callsByAddr.size());
+    addTable(header.funcsByName, funcsByName.data(), sizeof(uint32_t), funcsByName.size());
+    header.fileSize = sizeof header + data.size();
+
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof header);
+    out.write(data.data(), data.size());
+    if (!out.flush())  {
+	throw runtime_error{"error writing index file '" + path + "'"};
+    }
+}
+
+
+CallIndex::CallIndex(const std::string &path)
+{
+    auto invalid = [&path]()  {
+	return std::runtime_error{"'" + path + "' is not a valid call index"};
+    };
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)  {
+	throw std::runtime_error{"unable to open index file '" + path + "'"};
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(F::Header))  {
+	mapSize = st.st_size;
+	map = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)  {
+	throw invalid();
+    }
+
+    header = static_cast<const F::Header *>(map);
+    if (memcmp(header->magic, "CAINDEX", 8) || header->version != F::version
+	    || header->byteOrder != F::byteOrder || header->fileSize != mapSize)  {
+	munmap(map, mapSize);
+	throw invalid();
+    }
+
+    strings = Table<char>(header->strings);
+    functions = Table<F::FunctionEntry>(header->functions);
+    calls = Table<F::CallEntry>(header->calls);
+    callNames = Table<uint32_t>(header->callNames);
+    callees = Table<F::CalleeEntry>(header->callees);
+    postings = Table<uint32_t>(header->postings);
+    callsByAddr = Table<uint32_t>(header->callsByAddr);
+    funcsByName = Table<uint32_t>(header->funcsByName);
+    if (!strings || !functions || !calls || !callNames || !callees || !postings || !callsByAddr
+	    || !funcsByName
+	    || header->strings.count == 0 || strings[header->strings.count - 1] != '\0')  {
+	munmap(map, mapSize);
+	throw invalid();
+    }
+}
+
+
+CallIndex::~CallIndex()
+{
+    if (map != MAP_FAILED)  {
+	munmap(map, mapSize);
+    }
+}
+
+
+// Returns the table, or nullptr if it is not within the file.  The entries
+// themselves are trusted.
+template <typename T>
+const T *CallIndex::Table(const F::Table &t) const
+{
+    if (t.offset % alignof(T) || t.offset > mapSize || t.count > (mapSize - t.offset) / sizeof(T))  {
+	return nullptr;
+    }
+
+    return reinterpret_cast<const T *>(static_cast<const char *>(map) + t.offset);
+}
+
+
+// Returns the calls that may call a function named callee.
+std::vector<uint32_t> CallIndex::CallsTo(std::string_view callee) const
+{
+    auto end = callees + header->callees.count;
+    auto i = std::lower_bound(callees, end, callee, [this](const F::CalleeEntry &e, std::string_view name)  {
+	return String(e.name) < name;
+    });
+    if (i == end || String(i->name) != callee)  {
+	return {};
+    }
+
+    return std::vector<uint32_t>(postings + i->firstPosting, postings + i->firstPosting + i->numPostings);
+}
+
+
+// Returns the calls made by the functions named caller.
+std::vector<uint32_t> CallIndex::CallsFrom(std::string_view caller) const
+{
+    auto end = funcsByName + header->funcsByName.count;
+    auto i = std::lower_bound(funcsByName, end, caller, [this](uint32_t f, std::string_view name)  {
+	return String(functions[f].name) < name;
+    });
+
+    std::vector<uint32_t> result;
+    for (; i != end && String(functions[*i].name) == caller; ++i)  {
+	auto &f = functions[*i];
+	for (uint32_t c = 0; c < f.numCalls; ++c)  {
+	    result.push_back(f.firstCall + c);
+	}
+    }
+    sort(result.begin(), result.end());
+
+    return result;
+}
+
+
+// Returns the calls whose call instruction is in [start, end).
+std::vector<uint32_t> CallIndex::CallsInRange(uint64_t start, uint64_t end) const
+{
+    auto last = callsByAddr + header->callsByAddr.count;
+    auto byAddr = [this](uint32_t c, uint64_t addr)  {
+	return calls[c].callInsnAddr < addr;
+    };
+    auto first = std::lower_bound(callsByAddr, last, start, byAddr);
+    auto stop = std::lower_bound(first, last, end, byAddr);
+
+    return std::vector<uint32_t>(first, stop);
+}
+
+
+// Returns the function with the greatest entry address not above addr, or
+// nullptr if there is none.
+const CallIndex::F::FunctionEntry *CallIndex::FunctionAt(uint64_t addr) const
+{
+    auto end = functions + header->functions.count;
+    auto i = std::upper_bound(functions, end, addr, [](uint64_t addr, const F::FunctionEntry &f)  {
+	return addr < f.entry;
+    });
+
+    return i == functions ? nullptr : &*(i - 1);
+}
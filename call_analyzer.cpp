@@ -13,10 +13,30 @@
 //  limitations under the License.
 
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
+#include <omp.h>
 #include "Symtab.h"
 #include "CodeObject.h"
 #include "Instruction.h"
@@ -24,10 +44,29 @@
 #include "ABI.h"
 #include "Function.h"
 #include "jsonWriter.h"
+#include "workPool.h"
+#include "sha256.h"
+#include "elfFile.h"
+#include "resultCache.h"
+#include "registerMask.h"
+#include "functionRecord.h"
+#include "recordFile.h"
+#include "memoryUsage.h"
+#include "runStats.h"
+#include "callIndex.h"
+#include "dataflow.h"
+#include "functionSelection.h"
+#include "sharedLibraries.h"
+#include "compression.h"
+#include "unixSocket.h"
 
 
 
 class FunctionSummary;
+class CalleeSummaries;
+class BlockCache;
+struct BinaryTables;
+struct OutputFunction;
 
 using BlockAddress = unsigned long;
 using Block = Dyninst::ParseAPI::Block;
@@ -38,56 +77,260 @@ using RegisterSet = std::set<RegisterAST::Ptr>;
 using AddressVector = std::vector<BlockAddress>;
 using BlockAddressSet = std::set<BlockAddress>;
 
+// Maps a MachRegister to the ABI index of its base register (e.g. eax to
+// the index of rax, as RegisterAST::promote does), or to its own index if
+// the base register has none, or -1.  It is built once per ABI for every
+// register of each architecture and category (the high 16 bits of a
+// register's value) in the ABI's index map:  the high bits select a block of
+// entries indexed by the low 16 bits, so Index is two loads.
+class RegisterIndexTable
+{
+    public:
+	RegisterIndexTable(ABI *abi);
+	int Index(MachRegister r) const
+	{
+	    auto value = uint32_t(r.val());
+	    auto block = blocks[value >> blockBits];
+	    return block < 0 ? -1 : entries[(size_t(block) << blockBits) | (value & blockMask)];
+	}
+    private:
+	static const int	blockBits = 16;
+	static const uint32_t	blockMask = (1 << blockBits) - 1;
+
+	std::vector<int16_t>	blocks;
+	std::vector<int16_t>	entries;
+};
+
+
+// The register tables of an ABI:  the name of each of its register indices,
+// the index of each register, and the registers a call reads, returns and
+// may clobber.  ABI::getABI picks the ABI by address width, so the tables
+// are kept per address width.  They are built the first time a binary with
+// that width is summarized and only read after that, so binaries with
+// different ABIs can be analyzed by one process.
+class AbiRegisters
+{
+    public:
+	static const AbiRegisters &ForAddressWidth(int width);
+	ABI *Abi() const
+	{
+	    return abi;
+	}
+	int Index(MachRegister r) const
+	{
+	    return indexes.Index(r);
+	}
+	const std::string &Name(int id) const
+	{
+	    return names[id];
+	}
+	const std::vector<std::string> &Names() const
+	{
+	    return names;
+	}
+	const RegisterMask &CallParamRegisters() const
+	{
+	    return callParamRegisters;
+	}
+	const RegisterMask &CallReturnRegisters() const
+	{
+	    return callReturnRegisters;
+	}
+	const RegisterMask &CallNotKilledRegisters() const
+	{
+	    return callNotKilledRegisters;
+	}
+	const RegisterMask &CallClobberedRegisters() const
+	{
+	    return callClobberedRegisters;
+	}
+    private:
+	AbiRegisters(ABI *abi);
+	AbiRegisters(const AbiRegisters &) = delete;
+	AbiRegisters &operator=(const AbiRegisters &) = delete;
+
+	ABI					*abi;
+	std::vector<std::string>		names;
+	RegisterIndexTable			indexes;
+	RegisterMask				callParamRegisters;
+	RegisterMask				callReturnRegisters;
+	RegisterMask				callNotKilledRegisters;
+	RegisterMask				callClobberedRegisters;
+
+	static std::mutex					tablesMutex;
+	static std::map<int, std::unique_ptr<AbiRegisters>>	tables;
+};
+
+
+// What a block's instructions tell about it, the same in every function the
+// block is in.
+struct BlockFacts
+{
+    RegisterMask	usedRegs;
+    RegisterMask	writtenRegs;
+    Address		callInsnAddr = 0;
+    uint32_t		numInsns = 0;
+    bool		isCallBlock = false;
+    bool		isSysCallBlock = false;
+};
+
+
 class BlockSummary
 {
     public:
-	BlockSummary(FunctionSummary *f, Block *b);
+	BlockSummary(FunctionSummary *f, Block *b, BlockCache *cache = nullptr);
+	static BlockFacts Summarize(Block *b, const AbiRegisters &registers);
 	void AddParamReg(MachRegister r);
 	BlockAddress Addr() const
 	{
 	    return block->start();
 	}
+	BlockAddress EndAddr() const
+	{
+	    return block->end();
+	}
+	Block *CfgBlock() const
+	{
+	    return block;
+	}
+	size_t NumInsns() const
+	{
+	    return facts.numInsns;
+	}
 	bool IsCallBlock() const;
 	void IsCallBlock(bool b);
 	bool IsSysCallBlock() const;
 	void IsSysCallBlock(bool b);
 
-	void SetStartRegs(bitArray regs);
-	bitArray StartRegs() const;
-	bitArray UsedRegs() const;
-	bitArray OutRegs() const;
-	bitArray CallSiteRegs() const;
-	bitArray EnptyRegs() const;
+	void SetStartRegs(const RegisterMask &regs);
+	const RegisterMask &StartRegs() const;
+	const RegisterMask &UsedRegs() const;
+	const RegisterMask &WrittenRegs() const;
+	RegisterMask OutRegs() const;
+	RegisterMask OutRegs(const RegisterMask &start) const;
+	RegisterMask OutRegs(const RegisterMask &start, const RegisterMask &callClobbered) const;
+	RegisterMask CallSiteRegs() const;
+	RegisterMask EnptyRegs() const;
 
-	AddressVector Predecessors() const;
 	AddressVector Successors() const;
 
 	std::vector<std::string> CallNames() const;
-	void WriteJson(JsonWriter &writer) const;
-	void WriteJsonCall(
-		JsonWriter &writer,
+	void AddCallRecords(std::vector<CallRecord> &calls) const;
+	void AddCallRecord(
+		std::vector<CallRecord> &calls,
 		Address callAddr,
-		const std::vector<std::string> liveRegs,
-		std::vector<std::string> callNames,
+		const std::vector<RecordNames::Id> &callNames,
 		bool isToPlt
 		) const;
 
     private:
-	void SummarizeBlock();
-	void SummarizeInstruction(Instruction i);
+	static void SummarizeInstruction(Instruction i, BlockFacts &facts, const AbiRegisters &registers);
 	ABI *abi() const;
-	int AbiRegisterId(const RegisterAST::Ptr &r) const;
-	int PromotedRegisterId(const RegisterAST::Ptr &r) const;
-	bitArray RegisterSetToBitmap(const RegisterSet &rs) const;
+	static RegisterMask RegisterSetToBitmap(const RegisterSet &rs, const AbiRegisters &registers);
 	Architecture Arch() const;
 	
 	FunctionSummary	*function;
 	Block		*block;
-	bitArray	startRegs;
-	bitArray	usedRegs;
-	Address		callInsnAddr = 0;
-	bool		isCallBlock = false;
-	bool		isSysCallBlock = false;
+	BlockFacts	facts;
+	RegisterMask	startRegs;
+};
+
+
+// The facts of the blocks that are in more than one function (shared tails,
+// overlapping code, outlined parts), computed once for all of them.  Any
+// thread can use it.  The blocks are split between shards, each with its own
+// lock, and a block's facts are computed outside the lock.  An entry is
+// released once each function containing the block has taken it.  When
+// only some functions are summarized (a selection, --reachable or a server
+// request) that never happens for some blocks, so Clear drops what is left
+// at the end of each pass over a binary.
+class BlockCache
+{
+    public:
+	BlockFacts Facts(Block *b, const AbiRegisters &registers);
+	void Clear();
+	uint64_t Hits() const
+	{
+	    return hits;
+	}
+	uint64_t Misses() const
+	{
+	    return misses;
+	}
+    private:
+	struct Entry
+	{
+	    std::once_flag	once;
+	    BlockFacts		facts;
+	    std::atomic<int>	remaining;
+	};
+	struct Shard
+	{
+	    std::mutex						mutex;
+	    std::unordered_map<Block *, std::shared_ptr<Entry>>	entries;
+	};
+	static const size_t	numShards = 64;
+
+	Shard			shards[numShards];
+	std::atomic<uint64_t>	hits{0};
+	std::atomic<uint64_t>	misses{0};
+};
+
+
+// The code regions of a binary and the functions its calls can go to, found
+// once before its functions are summarized so a call record is made with
+// lookups instead of ParseAPI queries and string copies.  A callee is found
+// by the block a call goes to, the entry block of a function, and has the
+// ids in the binary's RecordNames of the names of the functions containing
+// that block and if any is in a PLT.  When only some functions are parsed,
+// a call to a function that is not is found by its address in the symbol
+// table and PLT names instead.
+class CalleeTable
+{
+    public:
+	using CodeRegion = Dyninst::ParseAPI::CodeRegion;
+
+	struct Region
+	{
+	    std::string			name;
+	    bool			isPlt = false;
+	};
+	struct Callee
+	{
+	    std::vector<RecordNames::Id>	names;
+	    bool				isToPlt = false;
+	};
+
+	void Build(Dyninst::ParseAPI::CodeObject *co, RecordNames &names,
+		const std::map<Address, std::vector<std::string>> *symbolNames = nullptr);
+	const Region *FindRegion(CodeRegion *r) const
+	{
+	    auto i = regions.find(r);
+	    return i != regions.end() ? &i->second : nullptr;
+	}
+	const Callee *Find(Block *b) const
+	{
+	    auto i = callees.find(b);
+	    if (i != callees.end())  {
+		return &i->second;
+	    }
+	    auto j = symbolCallees.find(b->start());
+	    return j != symbolCallees.end() ? &j->second : nullptr;
+	}
+    private:
+	std::unordered_map<CodeRegion *, Region>	regions;
+	std::unordered_map<Block *, Callee>		callees;
+	std::unordered_map<Address, Callee>		symbolCallees;
+};
+
+
+// What the functions of a binary share while they are summarized.  names
+// are the names the records of its functions refer to.
+struct BinaryTables
+{
+    BlockCache				blockCache;
+    CalleeTable				callees;
+    std::shared_ptr<RecordNames>	names;
 };
 
 bool operator==(const BlockSummary &a, const BlockSummary &b)
@@ -101,7 +344,7 @@ bool operator<(const BlockSummary &a, const BlockSummary &b)
 }
 
 using BlockSummarySet = std::set<BlockSummary>;
-using BlockSummaryMap = std::map<BlockAddress, BlockSummary>;
+using BlockSummaryVector = std::vector<BlockSummary>;
 
 
 
@@ -110,59 +353,158 @@ class FunctionSummary
     public:
 	using Function = Dyninst::ParseAPI::Function;
 
-	FunctionSummary(Function *f);
+	FunctionSummary(Function *f, const CalleeSummaries *summaries = nullptr,
+		BinaryTables *tables = nullptr);
+	const AbiRegisters &Registers() const
+	{
+	    return *registers;
+	}
+	RecordNames &Names() const
+	{
+	    return *names;
+	}
 
 	ABI *abi()
 	{
-	    return theAbi;
+	    return registers->Abi();
 	}
 
 	void AddParamRegs();
-	BlockSummary *AddBlock(Block *b);
 	BlockSummary *GetBlock(BlockAddress a);
 	const BlockSummary *GetBlock(BlockAddress a) const;
-	std::string RegIdToName(int id) const;
-	std::vector<std::string> RegBitmapToNames(bitArray regs) const;
 	Dyninst::SymtabAPI::Symtab *SymtabObject() const;
 	std::string RegionName() const;
 	static std::string RegionName(Function *func);
 	bool IsPltRegion() const;
 	static bool IsPltRegion(Function *func);
+	const CalleeTable *Callees() const
+	{
+	    return tables ? &tables->callees : nullptr;
+	}
 	void PropagateStartRegs();
-	bitArray CallParamRegisters() const
+	static uint64_t PropagationIterations()
 	{
-	    return callParamRegisters;
+	    return propagationIterations;
 	}
-	bitArray CallReturnRegisters() const
+	const RegisterMask &CallParamRegisters() const
 	{
-	    return callReturnRegisters;
+	    return registers->CallParamRegisters();
 	}
-	bitArray CallNotKilledRegisters() const
+	const RegisterMask &CallReturnRegisters() const
 	{
-	    return callNotKilledRegisters;
+	    return registers->CallReturnRegisters();
+	}
+	const RegisterMask &CallNotKilledRegisters() const
+	{
+	    return registers->CallNotKilledRegisters();
+	}
+	const RegisterMask &CallClobberedRegisters() const
+	{
+	    return registers->CallClobberedRegisters();
+	}
+	RegisterMask WrittenRegs() const;
+	size_t NumBlocks() const
+	{
+	    return blocks.size();
+	}
+	size_t NumInstructions() const;
+	Address EntryAddr() const
+	{
+	    return function->addr();
 	}
 	std::string FunctionName() const;
 	Address FunctionStartAddr() const;
-	static void WriteJsonAddressMember(JsonWriter &writer, std::string name, Address a);
+	FunctionRecord Record() const;
+	FunctionState State() const;
+	FunctionState Result(bool withState) const;
 	void WriteJson(JsonWriter &writer) const;
     private:
+	using BlockIndex = DataflowGraph::Node;
+
+	void AddBlocks();
+	BlockIndex FindBlock(BlockAddress a) const;
+
 	Function 				*function;
-	ABI					*theAbi;
-	BlockSummaryMap 			blocks;
-	BlockAddressSet				callBlocks;
-	static bool				initializedStatics;
-	static std::map<int, MachRegister>	regIdToReg;
-	static bitArray				callParamRegisters;
-	static bitArray				callReturnRegisters;
-	static bitArray				callNotKilledRegisters;
+	const AbiRegisters			*registers;
+	std::shared_ptr<RecordNames>		names;
+	const CalleeSummaries			*summaries;
+	BinaryTables				*tables;
+	BlockSummaryVector 			blocks;
+	DataflowGraph				graph;
+	std::vector<BlockIndex>			callBlocks;
+	static std::mutex			symtabMutex;
+	static std::atomic<uint64_t>		propagationIterations;
+};
+
+
+// The registers each function may clobber for its callers:  the registers
+// it, or a function it calls or jumps to, may write that the ABI does not
+// require a callee to preserve.  Holds the call graph used to compute them,
+// whose nodes are the indices of the functions written; an edge leads from
+// a function to each function it calls or jumps to.  PLT stubs and unknown
+// code (unresolved indirect calls and jumps) may clobber every register the
+// ABI allows.
+class CalleeSummaries
+{
+    public:
+	using Function = Dyninst::ParseAPI::Function;
+	using Node = DataflowGraph::Node;
+
+	CalleeSummaries(const std::vector<OutputFunction> &funcs);
+	const DataflowGraph &CallGraph() const
+	{
+	    return callGraph;
+	}
+	bool CallsUnknown(Node n) const
+	{
+	    return callsUnknown[n];
+	}
+	const RegisterMask &Clobbered(Node n) const
+	{
+	    return clobbered[n];
+	}
+	void SetClobbered(Node n, const RegisterMask &regs)
+	{
+	    clobbered[n] = regs;
+	}
+	RegisterMask CallClobbered(Block *callBlock, const RegisterMask &unknown) const;
+    private:
+	bool AddCallees(Block *b, bool withJumps, std::vector<Node> &callees) const;
+
+	std::unordered_map<Function *, Node>	nodes;
+	DataflowGraph				callGraph;
+	std::vector<bool>			callsUnknown;
+	std::vector<RegisterMask>		clobbered;
 };
 
 
-bool FunctionSummary::initializedStatics = false;
-std::map<int, MachRegister> FunctionSummary::regIdToReg;
-bitArray FunctionSummary::callParamRegisters;
-bitArray FunctionSummary::callReturnRegisters;
-bitArray FunctionSummary::callNotKilledRegisters;
+// Returns the SHA-256 of the code in the ranges relative to entry, or "" if
+// any of the ranges is not in the binary.
+std::string CodeHash(
+	Dyninst::ParseAPI::CodeSource *cs,
+	Address entry,
+	const std::vector<std::pair<long, unsigned long>> &ranges
+    )
+{
+    Sha256 sha;
+    for (auto &r: ranges)  {
+	Address start = entry + r.first;
+	if (r.second == 0 || !cs->isValidAddress(start) || !cs->isValidAddress(start + r.second - 1))  {
+	    return "";
+	}
+	sha.Update(&r.first, sizeof r.first);
+	sha.Update(&r.second, sizeof r.second);
+	sha.Update(cs->getPtrToInstruction(start), r.second);
+    }
+
+    return sha.HexDigest();
+}
+
+
+std::mutex FunctionSummary::symtabMutex;
+std::atomic<uint64_t> FunctionSummary::propagationIterations{0};
+std::mutex AbiRegisters::tablesMutex;
+std::map<int, std::unique_ptr<AbiRegisters>> AbiRegisters::tables;
 
 
 char emptyString[] = "";
@@ -170,11 +512,42 @@ struct Options
 {
     void ProcessOptions(int argc, char **argv);
     void Error(const std::string &msg);
+    const char *OptionArg(const char *name, int &i, int argc, char **argv);
+    unsigned CountArg(const char *name, const char *value);
+    uint64_t SizeArg(const char *name, const char *value);
+    std::string RecordSignature() const;
+    std::string OutputSignature(bool binary, int outputIndent) const;
     bool			help = false;
     bool			version = false;
     bool			debug = false;
     bool			onlyToPltCalls = true;
+    bool			interprocedural = false;
     int				indent = 2;
+    bool			binaryOutput = false;
+    CompressingStreambuf::Codec	compression = CompressingStreambuf::none;
+    int				compressionLevel = 0;
+    bool			compressionGiven = false;
+    unsigned			jobs = 1;
+    unsigned			parseThreads = 0;
+    bool			timing = false;
+    bool			stats = false;
+    const char *		statsFile = nullptr;
+    const char *		batchList = nullptr;
+    const char *		batchDir = nullptr;
+    const char *		cacheDir = nullptr;
+    uint64_t			cacheMaxSize = uint64_t(1) << 30;
+    uint64_t			maxMemory = 0;
+    const char *		saveState = nullptr;
+    const char *		previousState = nullptr;
+    const char *		indexFile = nullptr;
+    const char *		serveSocket = nullptr;
+    uint64_t			serveMemory = uint64_t(4) << 30;
+    unsigned			serveClients = 16;
+    FunctionSelection		selection;
+    bool			reachable = false;
+    bool			dependencies = false;
+    std::string			sysroot;
+    std::vector<std::string>	libraryPath;
     bool			failed = false;
     std::string			failureMsg;
     std::vector<char*>	args;
@@ -187,6 +560,74 @@ struct Options
 Options options;
 
 
+// What --stats reports.  The phases of a function (summarizeBlocks,
+// addParamRegs, propagateStartRegs) are summed over the worker threads, so
+// their wall clock time can exceed the summarize phase's.
+struct RunStatistics
+{
+    PhaseTime *Phase(PhaseTime &phase)
+    {
+	return enabled ? &phase : nullptr;
+    }
+    void WriteJson(std::ostream &out) const;
+
+    bool			enabled = false;
+    bool			cacheHit = false;
+    PhaseTime			total;
+    PhaseTime			symtabLoad;
+    PhaseTime			parse;
+    PhaseTime			summarize;
+    PhaseTime			summarizeBlocks;
+    PhaseTime			addParamRegs;
+    PhaseTime			propagateStartRegs;
+    PhaseTime			write;
+    uint64_t			functions = 0;
+    uint64_t			functionsReused = 0;
+    uint64_t			blocks = 0;
+    std::atomic<uint64_t>	instructions{0};
+    uint64_t			sharedBlockHits = 0;
+    uint64_t			sharedBlockMisses = 0;
+    uint64_t			dataflowIterations = 0;
+    std::atomic<uint64_t>	callSites{0};
+    uint64_t			bytesWritten = 0;
+    SlowestFunctions		slowest{10};
+};
+
+RunStatistics runStats;
+
+
+
+
+RegisterIndexTable::RegisterIndexTable(ABI *abi)
+    :
+	blocks(size_t(1) << (32 - blockBits), -1)
+{
+    auto indexMap = abi->getIndexMap();
+    for (auto &i: *indexMap)  {
+	auto &block = blocks[uint32_t(i.first.val()) >> blockBits];
+	if (block < 0)  {
+	    block = entries.size() >> blockBits;
+	    entries.resize(entries.size() + blockMask + 1, -1);
+	}
+    }
+
+    for (uint32_t high = 0; high < blocks.size(); ++high)  {
+	if (blocks[high] < 0)  {
+	    continue;
+	}
+	auto first = size_t(blocks[high]) << blockBits;
+	for (uint32_t low = 0; low <= blockMask; ++low)  {
+	    MachRegister r{int(high << blockBits | low)};
+	    auto i = indexMap->find(r.getBaseRegister());
+	    if (i == indexMap->end())  {
+		i = indexMap->find(r);
+	    }
+	    if (i != indexMap->end())  {
+		entries[first + low] = i->second;
+	    }
+	}
+    }
+}
 
 
 Architecture BlockSummary::Arch() const
@@ -195,124 +636,133 @@ Architecture BlockSummary::Arch() const
 }
 
 
-inline BlockSummary::BlockSummary(FunctionSummary *f, Block *b) :
+// The block's facts are taken from cache if it is not null.
+inline BlockSummary::BlockSummary(FunctionSummary *f, Block *b, BlockCache *cache) :
     function(f),
     block(b),
-    startRegs(EnptyRegs()),
-    usedRegs(EnptyRegs())
+    facts(cache ? cache->Facts(b, f->Registers()) : Summarize(b, f->Registers()))
 {
-    using namespace std;
-    SummarizeBlock();
 }
 
 
-void BlockSummary::SummarizeBlock()
+// Decodes the block's instructions and returns what they tell about it.
+BlockFacts BlockSummary::Summarize(Block *b, const AbiRegisters &registers)
 {
     using namespace InstructionAPI;
 
+    BlockFacts facts;
     Block::Insns instructions;
-    block->getInsns(instructions);
+    b->getInsns(instructions);
+    facts.numInsns = instructions.size();
     for (auto i: instructions)  {
-	SummarizeInstruction(i.second);
+	SummarizeInstruction(i.second, facts, registers);
 	switch (i.second.getCategory())  {
 	    case c_CallInsn:
-		callInsnAddr = i.first;
-		IsCallBlock(true);
+		facts.callInsnAddr = i.first;
+		facts.isCallBlock = true;
 		break;
 	    case c_SysEnterInsn:
 	    case c_SyscallInsn:
-		IsSysCallBlock(true);
+		facts.isSysCallBlock = true;
 		break;
 	    default:
 		// ordinary instruction
 		break;
 	}
     }
+
+    return facts;
 }
 
 
 void BlockSummary::AddParamReg(MachRegister r)
 {
-    using namespace InstructionAPI;
-
-    auto regAST = new RegisterAST{r};
-    auto reg = RegisterAST::Ptr{regAST};
-    auto regId = PromotedRegisterId(reg);
-    usedRegs[regId] = 1;
+    auto regId = function->Registers().Index(r);
+    if (regId != -1)  {
+	facts.usedRegs.Set(regId);
+    }
 }
 
 
 bool BlockSummary::IsCallBlock() const
 {
-    return isCallBlock;
+    return facts.isCallBlock;
 }
 
 
 void BlockSummary::IsCallBlock(bool b)
 {
-    isCallBlock = b;
+    facts.isCallBlock = b;
 }
 
 
 bool BlockSummary::IsSysCallBlock() const
 {
-    return isSysCallBlock;
+    return facts.isSysCallBlock;
 }
 
 
-void BlockSummary::SetStartRegs(bitArray regs)
+void BlockSummary::SetStartRegs(const RegisterMask &regs)
 {
     startRegs = regs;
 }
 
 
-bitArray BlockSummary::StartRegs() const
+const RegisterMask &BlockSummary::StartRegs() const
 {
     return startRegs;
 }
 
 
-bitArray BlockSummary::UsedRegs() const
+const RegisterMask &BlockSummary::UsedRegs() const
 {
-    return usedRegs;
+    return facts.usedRegs;
 }
 
 
-bitArray BlockSummary::OutRegs() const
+const RegisterMask &BlockSummary::WrittenRegs() const
 {
-    bitArray out{usedRegs};
-    out |= startRegs;
-    if (IsCallBlock())  {
-	out &= function->CallNotKilledRegisters();
-	out |= function->CallReturnRegisters();
-    }
+    return facts.writtenRegs;
+}
 
-    return out;
+
+RegisterMask BlockSummary::OutRegs() const
+{
+    return OutRegs(startRegs);
 }
 
 
-bitArray BlockSummary::CallSiteRegs() const
+// Returns the registers set on exit from the block if start are the
+// registers set on entry, assuming a call clobbers every register the ABI
+// allows.
+RegisterMask BlockSummary::OutRegs(const RegisterMask &start) const
 {
-    bitArray out{usedRegs};
-    out |= startRegs;
+    return OutRegs(start, function->CallClobberedRegisters());
+}
+
+
+// Returns the registers set on exit from the block if start are the
+// registers set on entry and the block's call clobbers callClobbered:
+// those are no longer set, except the return registers among them.
+RegisterMask BlockSummary::OutRegs(const RegisterMask &start, const RegisterMask &callClobbered) const
+{
+    RegisterMask out{facts.usedRegs};
+    out |= start;
+    if (IsCallBlock())  {
+	out &= ~callClobbered;
+	out |= callClobbered & function->CallReturnRegisters();
+    }
 
     return out;
 }
 
 
-AddressVector BlockSummary::Predecessors() const
+RegisterMask BlockSummary::CallSiteRegs() const
 {
-    AddressVector addrs;
-    for (auto e: block->sources())  {
-	if (!e->interproc())  {
-	    auto blockAddr = e->src()->start();
-	    if (blockAddr != BlockAddress(-1))  {
-		addrs.push_back(blockAddr);
-	    }
-	}
-    }
+    RegisterMask out{facts.usedRegs};
+    out |= startRegs;
 
-    return addrs;
+    return out;
 }
 
 
@@ -348,11 +798,13 @@ std::vector<std::string> BlockSummary::CallNames() const
 }
 
 
-void BlockSummary::WriteJsonCall(
-	JsonWriter &writer,
+// Adds the call record unless only calls to the PLT are wanted and it is
+// not one.  The registers are masks and the names ids, made into strings
+// only when the record is written.
+void BlockSummary::AddCallRecord(
+	std::vector<CallRecord> &calls,
 	Address callAddr,
-	const std::vector<std::string> liveRegs,
-	std::vector<std::string> callNames,
+	const std::vector<RecordNames::Id> &callNames,
 	bool isToPlt
     ) const
 {
@@ -360,72 +812,80 @@ void BlockSummary::WriteJsonCall(
 	return;
     }
 
-    writer.OpenObject();
-
-    function->WriteJsonAddressMember(writer, "callInstructionAddr", callInsnAddr);
-    function->WriteJsonAddressMember(writer, "calledAddr", callAddr);
-    writer.AddMemberKey("callToPlt");
-    writer.AddScalar(isToPlt);
-    writer.AddMemberKey("liveRegisters");
-    writer.OpenArray();
-    for (auto name : liveRegs)  {
-	writer.AddScalar(name);
-    }
-    writer.CloseArray();
-    writer.AddMemberKey("funcNames");
-    writer.OpenArray();
-    for (auto name: callNames)  {
-	writer.AddScalar(name);
+    CallRecord call;
+    call.callInsnAddr = facts.callInsnAddr;
+    call.calledAddr = callAddr;
+    call.isToPlt = isToPlt;
+    call.liveRegs = UsedRegs() & function->CallParamRegisters();
+    if (options.interprocedural)  {
+	call.hasSetRegs = true;
+	call.setRegs = CallSiteRegs() & function->CallParamRegisters();
     }
-    writer.CloseArray();
-    writer.CloseObject();
+    call.funcNames = callNames;
+    calls.push_back(std::move(call));
 }
 
 
-void BlockSummary::WriteJson(JsonWriter &writer) const
+// Adds a record for each call the block makes, or one with no callee if
+// the call's target is unknown.  The callees are looked up in the callee
+// table if there is one, and found with ParseAPI otherwise (or if the call
+// does not go to a function's entry).
+void BlockSummary::AddCallRecords(std::vector<CallRecord> &calls) const
 {
     using namespace std;
 
-    auto usedRegs = UsedRegs() & function->CallParamRegisters();
-    auto regNames = function->RegBitmapToNames(usedRegs);
-
+    auto callees = function->Callees();
     int numCallTargets = 0;
     for (auto e : block->targets())  {
 	auto outBlock = e->trg();
 	auto callAddr = outBlock->start();
 	if (e->type() == ParseAPI::CALL)  {
+	    ++numCallTargets;
+	    if (auto callee = callees ? callees->Find(outBlock) : nullptr)  {
+		AddCallRecord(calls, callAddr, callee->names, callee->isToPlt);
+		continue;
+	    }
+
 	    bool isToPlt = false;
 	    vector<ParseAPI::Function *> funcs;
 	    auto i = back_inserter(funcs);
 	    outBlock->getFuncs(i);
-	    vector<string> funcNames;
+	    vector<RecordNames::Id> funcNames;
 	    for (auto f: funcs)  {
 		isToPlt |= function->IsPltRegion(f);
-		funcNames.push_back(f->name());
+		funcNames.push_back(function->Names().Add(f->name()));
 	    }
-	    ++numCallTargets;
-	    WriteJsonCall(writer, callAddr, regNames, funcNames, isToPlt);
+	    AddCallRecord(calls, callAddr, funcNames, isToPlt);
 	}
     }
     
     if (numCallTargets == 0)  {
-	WriteJsonCall(writer, Address(-1), regNames, {}, false);
+	AddCallRecord(calls, Address(-1), {}, false);
     }
 }
     
 
 void BlockSummary::IsSysCallBlock(bool b)
 {
-    isSysCallBlock = b;
+    facts.isSysCallBlock = b;
 }
 
 
-void BlockSummary::SummarizeInstruction(Instruction i)
+// Adds the registers the instruction writes and reads to the facts.
+// InstructionAPI returns them in a RegisterSet, so one set (and a node per
+// register) is still allocated per instruction; only the masks they are
+// collected into are inline.
+void BlockSummary::SummarizeInstruction(Instruction i, BlockFacts &facts, const AbiRegisters &registers)
 {
     RegisterSet regs;
-    i.getReadSet(regs);
     i.getWriteSet(regs);
-    usedRegs |= RegisterSetToBitmap(regs);
+    auto written = RegisterSetToBitmap(regs, registers);
+    facts.writtenRegs |= written;
+    facts.usedRegs |= written;
+
+    regs.clear();
+    i.getReadSet(regs);
+    facts.usedRegs |= RegisterSetToBitmap(regs, registers);
 }
 
 
@@ -435,83 +895,164 @@ ABI *BlockSummary::abi() const
 }
 
 
-bitArray BlockSummary::EnptyRegs() const
+RegisterMask BlockSummary::EnptyRegs() const
 {
-    return abi()->getBitArray();
+    return RegisterMask{};
 }
 
 
-int BlockSummary::AbiRegisterId(const RegisterAST::Ptr &r) const
+RegisterMask BlockSummary::RegisterSetToBitmap(const RegisterSet &rs, const AbiRegisters &registers)
 {
-    return abi()->getIndex(r->getID());
+    RegisterMask bitmap;
+    for (auto &r: rs)  {
+	auto regId = registers.Index(r->getID());
+	if (regId != -1)  {
+	    bitmap.Set(regId);
+	}
+    }
+
+    return bitmap;
 }
 
 
-int BlockSummary::PromotedRegisterId(const RegisterAST::Ptr &r) const
+// Returns the block's facts.  A block in only one function is summarized
+// without being cached.
+BlockFacts BlockCache::Facts(Block *b, const AbiRegisters &registers)
 {
-    auto promotedReg = r->promote(r);
-    auto id = AbiRegisterId(promotedReg);
-    if (id != -1)  {
-	return id;
-    }  else  {
-	return AbiRegisterId(r);
+    int numFuncs = b->containingFuncs();
+    if (numFuncs <= 1)  {
+	return BlockSummary::Summarize(b, registers);
+    }
+
+    auto &shard = shards[(uintptr_t(b) >> 4) % numShards];
+    std::shared_ptr<Entry> entry;
+    {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto &e = shard.entries[b];
+	if (!e)  {
+	    e = std::make_shared<Entry>();
+	    e->remaining = numFuncs;
+	}
+	entry = e;
+    }
+
+    bool summarized = false;
+    std::call_once(entry->once, [&]  {
+	entry->facts = BlockSummary::Summarize(b, registers);
+	summarized = true;
+    });
+    ++(summarized ? misses : hits);
+
+    if (--entry->remaining == 0)  {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	shard.entries.erase(b);
     }
+
+    return entry->facts;
 }
 
 
-bitArray BlockSummary::RegisterSetToBitmap(const RegisterSet &rs) const
+void BlockCache::Clear()
 {
-    auto bitmap{EnptyRegs()};
-    for (auto r: rs)  {
-	auto regId = PromotedRegisterId(r);
-	bitmap[regId] = 1;
+    for (auto &shard: shards)  {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	shard.entries.clear();
     }
-
-    return bitmap;
 }
 
 
 
 
-FunctionSummary::FunctionSummary(Function *f) :
+// Summarizes the function.  If summaries is not null the calls to other
+// functions use their summaries, and PropagateStartRegs has to be called
+// once the summaries of the functions it calls are set.  If tables is not
+// null, the blocks shared with other functions and the callees are looked
+// up in them.
+FunctionSummary::FunctionSummary(Function *f, const CalleeSummaries *summaries, BinaryTables *tables) :
     function(f),
-    theAbi(ABI::getABI(f->obj()->cs()->getAddressWidth()))
+    registers(&AbiRegisters::ForAddressWidth(f->obj()->cs()->getAddressWidth())),
+    names(tables && tables->names ? tables->names : std::make_shared<RecordNames>(registers->Names())),
+    summaries(summaries),
+    tables(tables)
 {
     using namespace std;
 
-    if (!initializedStatics)  {
-	for (auto i: *abi()->getIndexMap())  {
-	    regIdToReg[i.second] = i.first;
-	}
+    AddBlocks();
+    AddParamRegs();
+    if (!summaries)  {
+	PropagateStartRegs();
+    }
+}
+
+
+RegisterMask ToRegisterMask(const bitArray &bits)
+{
+    RegisterMask mask;
+    for (auto i = bits.find_first(); i != bitArray::npos; i = bits.find_next(i))  {
+	mask.Set(i);
+    }
+
+    return mask;
+}
+
 
-	// param registers: rax rcx rsi rdi r8 r9 xxm0-7
-	callParamRegisters = theAbi->getCallReadRegisters();
+// Returns the tables of the ABI for the address width, building them the
+// first time.  It is safe to call from multiple threads.
+const AbiRegisters &AbiRegisters::ForAddressWidth(int width)
+{
+    std::lock_guard<std::mutex> lock(tablesMutex);
+    auto &t = tables[width];
+    if (!t)  {
+	t.reset(new AbiRegisters(ABI::getABI(width)));
+    }
 
-	// return registers: rax rdx xxm0-1
-	callReturnRegisters = theAbi->getReturnRegisters();
-	callReturnRegisters[109] = 1;	// +xxm0
-	callReturnRegisters[110] = 1;	// +xxm1
+    return *t;
+}
 
-	// caller saved registers: rbx rsp rbp r12 r13 r14 r15
-	// not killed registers: callerSavedRegs | returnRegs
-	// not killed registers: rax rdx rbx rsp rbp r12 r13 r14 r15 xxm0-1
-	callNotKilledRegisters = theAbi->getReturnReadRegisters();
-	callNotKilledRegisters[1] = 0;	// -rcx
-	callNotKilledRegisters[4] = 1;	// +rsp
-	callNotKilledRegisters[5] = 1;	// +rbp
 
-	initializedStatics = true;
+AbiRegisters::AbiRegisters(ABI *abi)
+    :
+	abi(abi),
+	names(RegisterMask::numBits),
+	indexes(abi)
+{
+    auto indexMap = abi->getIndexMap();
+    if (indexMap->size() > RegisterMask::numBits)  {
+	throw std::runtime_error{"ABI has " + std::to_string(indexMap->size())
+		+ " registers, RegisterMask holds " + std::to_string(RegisterMask::numBits)};
+    }
+    for (auto i: *indexMap)  {
+	auto name = i.first.name();
+	names[i.second] = name.substr(name.rfind(':') + 1);
     }
 
-    for (auto b: f->blocks())  {
-	auto blockSummary = AddBlock(b);
-	if (blockSummary->IsCallBlock())  {
-	    callBlocks.insert(b->start());
+    // sets or resets the bits of the named registers the ABI has
+    auto setNamed = [indexMap](RegisterMask &mask, std::initializer_list<const char *> regNames, bool set)  {
+	for (auto &i: *indexMap)  {
+	    for (auto n: regNames)  {
+		if (i.first.name() == n)  {
+		    set ? mask.Set(i.second) : mask.Reset(i.second);
+		}
+	    }
 	}
-    }
+    };
 
-    AddParamRegs();
-    PropagateStartRegs();
+    // param registers (x86_64): rax rcx rsi rdi r8 r9 xxm0-7
+    callParamRegisters = ToRegisterMask(abi->getCallReadRegisters());
+
+    // return registers (x86_64): rax rdx xxm0-1
+    callReturnRegisters = ToRegisterMask(abi->getReturnRegisters());
+    setNamed(callReturnRegisters, {"x86_64::xmm0", "x86_64::xmm1"}, true);
+
+    // caller saved registers: rbx rsp rbp r12 r13 r14 r15
+    // not killed registers: callerSavedRegs | returnRegs
+    // not killed registers (x86_64): rax rdx rbx rsp rbp r12 r13 r14 r15 xxm0-1
+    callNotKilledRegisters = ToRegisterMask(abi->getReturnReadRegisters());
+    setNamed(callNotKilledRegisters, {"x86_64::rcx", "x86::ecx"}, false);
+    setNamed(callNotKilledRegisters, {"x86_64::rsp", "x86_64::rbp", "x86::esp", "x86::ebp"}, true);
+
+    // registers a callee may clobber:  all but the callee saved registers
+    callClobberedRegisters = ~(callNotKilledRegisters & ~callReturnRegisters);
 }
 
 
@@ -520,12 +1061,17 @@ void FunctionSummary::AddParamRegs()
     using namespace std;
     using namespace Dyninst;
 
+    PhaseTimer timer(runStats.Phase(runStats.addParamRegs));
+
     if (function->blocks().empty())  {
 	return;
     }
 
     auto symtab = SymtabObject();
 
+    // SymtabAPI parses the DWARF parameter information lazily
+    lock_guard<mutex> lock(symtabMutex);
+
     SymtabAPI::Function *symtabFunc;
     auto entryBlock = function->entry();
     Address entryAddr = entryBlock->start();
@@ -569,49 +1115,83 @@ void FunctionSummary::AddParamRegs()
 }
 
 
-BlockSummary *FunctionSummary::AddBlock(Block *b)
+// Summarizes the function's blocks into an array in address order, and
+// builds the graph of the edges between them (using their indices in the
+// array) and the list of call blocks.  Edges to blocks outside the function
+// and interprocedural edges are left out of the graph.
+void FunctionSummary::AddBlocks()
 {
-    auto addr = b->start();
-    auto insert_pair = std::make_pair(addr, BlockSummary(this, b));
-    auto i = blocks.insert(insert_pair);
-    if (!i.second)  {
-	std::cerr << "block address (" << addr << ") already processed";
+    using namespace std;
+
+    PhaseTimer timer(runStats.Phase(runStats.summarizeBlocks));
+
+    vector<Block *> sorted;
+    for (auto b: function->blocks())  {
+	sorted.push_back(b);
+    }
+    sort(sorted.begin(), sorted.end(), [](Block *a, Block *b)  {
+	return a->start() < b->start();
+    });
+
+    blocks.reserve(sorted.size());
+    for (auto b: sorted)  {
+	if (!blocks.empty() && blocks.back().Addr() == b->start())  {
+	    cerr << "block address (" << b->start() << ") already processed";
+	    continue;
+	}
+	blocks.emplace_back(this, b, tables ? &tables->blockCache : nullptr);
+	if (blocks.back().IsCallBlock())  {
+	    callBlocks.push_back(blocks.size() - 1);
+	}
     }
 
-    return &i.first->second;
+    vector<pair<BlockIndex, BlockIndex>> edges;
+    for (BlockIndex i = 0; i < blocks.size(); ++i)  {
+	for (auto a: blocks[i].Successors())  {
+	    auto j = FindBlock(a);
+	    if (j != blocks.size())  {
+		edges.emplace_back(i, j);
+	    }
+	}
+    }
+    graph.Build(blocks.size(), edges);
 }
 
 
-BlockSummary *FunctionSummary::GetBlock(BlockAddress a)
+// Returns the index of the block starting at a, or blocks.size() if none.
+FunctionSummary::BlockIndex FunctionSummary::FindBlock(BlockAddress a) const
 {
-    auto i = blocks.find(a);
-    if (i != blocks.end())  {
-	return &i->second;
+    auto i = std::lower_bound(blocks.begin(), blocks.end(), a,
+	    [](const BlockSummary &b, BlockAddress a)  {
+		return b.Addr() < a;
+	    });
+    if (i != blocks.end() && i->Addr() == a)  {
+	return i - blocks.begin();
     }  else  {
-	return nullptr;
+	return blocks.size();
     }
 }
 
 
-const BlockSummary *FunctionSummary::GetBlock(BlockAddress a) const
+BlockSummary *FunctionSummary::GetBlock(BlockAddress a)
 {
-    auto i = blocks.find(a);
-    if (i != blocks.end())  {
-	return &i->second;
+    auto i = FindBlock(a);
+    if (i != blocks.size())  {
+	return &blocks[i];
     }  else  {
 	return nullptr;
     }
 }
 
 
-std::string FunctionSummary::RegIdToName(int id) const
+const BlockSummary *FunctionSummary::GetBlock(BlockAddress a) const
 {
-    auto name = regIdToReg[id].name();
-    auto i = name.rfind(':');
-    if (i != name.npos)  {
-	name.erase(0, i + 1);
+    auto i = FindBlock(a);
+    if (i != blocks.size())  {
+	return &blocks[i];
+    }  else  {
+	return nullptr;
     }
-    return name;
 }
 
 
@@ -627,22 +1207,6 @@ Dyninst::SymtabAPI::Symtab *FunctionSummary::SymtabObject() const
 }
 
 
-std::vector<std::string> FunctionSummary::RegBitmapToNames(bitArray regs) const
-{
-    using namespace std;
-
-    vector<string> regNames;
-    auto size = regs.size();
-    auto i = regs.find_first();
-    while (i < size)  {
-	regNames.push_back(RegIdToName(i));
-	i = regs.find_next(i);
-    }
-
-    return regNames;
-}
-
-
 std::string FunctionSummary::RegionName() const
 {
     return RegionName(function);
@@ -677,48 +1241,61 @@ bool FunctionSummary::IsPltRegion(Function *func)
 }
 
 
+// Sets the start registers of each block to the union of the out registers
+// of its predecessors in the function, the least fixed point starting from
+// no registers.  With callee summaries a call only clobbers the registers
+// its callees may clobber.  The number of blocks evaluated by the solver is
+// added to PropagationIterations().
 void FunctionSummary::PropagateStartRegs()
 {
-    using namespace std;
+    PhaseTimer timer(runStats.Phase(runStats.propagateStartRegs));
+    auto entry = FindBlock(function->addr());
+
+    std::vector<RegisterMask> callClobbered;
+    if (summaries)  {
+	callClobbered.resize(blocks.size());
+	for (auto i: callBlocks)  {
+	    callClobbered[i] = summaries->CallClobbered(blocks[i].CfgBlock(), CallClobberedRegisters());
+	}
+    }
 
-    set<BlockAddress> toProcess;
-    for (auto i: blocks)  {
-	toProcess.insert(i.first);
+    DataflowSolver<RegisterMask> solver(graph);
+    auto stats = solver.Solve(entry != blocks.size() ? entry : 0,
+	    [&](BlockIndex i, const RegisterMask &start)  {
+		if (summaries)  {
+		    return blocks[i].OutRegs(start, callClobbered[i]);
+		}
+		return blocks[i].OutRegs(start);
+	    });
+    for (BlockIndex i = 0; i < blocks.size(); ++i)  {
+	blocks[i].SetStartRegs(solver.In(i));
     }
 
-    while (!toProcess.empty())  {
-	auto i = toProcess.begin();
-	auto addr = *i;
-	auto block = GetBlock(addr);
-	toProcess.erase(i);
+    propagationIterations += stats.iterations;
+}
 
-//jk	cout << "PropStart:   " << hex << addr << dec << endl;
-//jk	if (block)  {
-//jk	    for (auto a: block->Predecessors())  {
-//jk		cout << "PropStart:     before " << hex << a << dec << endl;
-//jk	    }
-//jk	    for (auto a: block->Successors())  {
-//jk		cout << "PropStart:     after " << hex << a << dec << endl;
-//jk	    }
-//jk	}
 
-	auto newStartRegs{block->EnptyRegs()};
-	for (auto a: block->Predecessors())  {
-	    newStartRegs |= GetBlock(a)->OutRegs();
-	}
-//jk	cout << "PropStart:     old start:" << endl;
-//jk	//jk PrintRegs(this, block->StartRegs());
-//jk	cout << "PropStart:     new regs:" << endl;
-//jk	//jk PrintRegs(this, newStartRegs);
+size_t FunctionSummary::NumInstructions() const
+{
+    size_t n = 0;
+    for (auto &b: blocks)  {
+	n += b.NumInsns();
+    }
 
-	if (newStartRegs != block->StartRegs())  {
-	    block->SetStartRegs(newStartRegs);
-	    for (auto a: block->Successors())  {
-//jk		cout << "PropStart:     prop  " << hex << a << dec << endl;
-		toProcess.insert(a);
-	    }
-	}
+    return n;
+}
+
+
+// Returns the registers the function's own code may write that a callee
+// may clobber.
+RegisterMask FunctionSummary::WrittenRegs() const
+{
+    RegisterMask regs;
+    for (auto &b: blocks)  {
+	regs |= b.WrittenRegs();
     }
+
+    return regs & CallClobberedRegisters();
 }
 
 
@@ -734,39 +1311,88 @@ Address FunctionSummary::FunctionStartAddr() const
 }
 
 
-void FunctionSummary::WriteJsonAddressMember(JsonWriter &writer, std::string name, Address a)
+FunctionRecord FunctionSummary::Record() const
 {
-    writer.AddMemberKey(name);
-    if (a != Address(-1))  {
-	writer.AddScalar(a);
-    }  else  {
-	writer.AddNull();
+    FunctionRecord record;
+    record.name = FunctionName();
+    record.addr = FunctionStartAddr();
+    auto region = tables ? tables->callees.FindRegion(function->region()) : nullptr;
+    record.section = region ? region->name : RegionName();
+    record.isInPlt = region ? region->isPlt : IsPltRegion();
+    record.names = names;
+
+    for (auto i: callBlocks)  {
+	blocks[i].AddCallRecords(record.calls);
     }
+
+    return record;
 }
 
 
-void FunctionSummary::WriteJson(JsonWriter &writer) const
+// Returns the record with what is needed to reuse it in a later run:  the
+// ranges covered by the function's blocks relative to its entry and the
+// SHA-256 of the code in those ranges.  Identical code produces an
+// identical record apart from addresses, as long as the callees are the same.
+FunctionState FunctionSummary::State() const
 {
     using namespace std;
 
-    writer.OpenObject();
-    writer.AddMemberKey("funcName");
-    writer.AddScalar(FunctionName());
-    WriteJsonAddressMember(writer, "funcAddr", FunctionStartAddr());
-    writer.AddMemberKey("sectionName");
-    writer.AddScalar(RegionName());
-    writer.AddMemberKey("isInPlt");
-    writer.AddScalar(IsPltRegion());
-    writer.AddMemberKey("calls");
-    writer.OpenArray();
+    FunctionState state;
+    state.record = Record();
+    state.entry = function->addr();
 
-    for (auto b: callBlocks)  {
-	auto block = GetBlock(b);
-	block->WriteJson(writer);
+    auto cs = function->obj()->cs();
+    auto &linkage = cs->linkage();
+    if (linkage.find(state.entry) != linkage.end())  {
+	state.hasSymbol = true;
+    }  else  {
+	lock_guard<mutex> lock(symtabMutex);
+	SymtabAPI::Function *symtabFunc;
+	state.hasSymbol = SymtabObject()->findFuncByEntryOffset(symtabFunc, state.entry);
     }
 
-    writer.CloseArray();
-    writer.CloseObject();
+    // blocks are in address order, merge adjacent blocks into one range
+    Address rangeStart = 0, rangeEnd = 0;
+    auto addRange = [&]  {
+	if (rangeEnd > rangeStart)  {
+	    state.codeRanges.emplace_back(long(rangeStart - state.entry), rangeEnd - rangeStart);
+	}
+    };
+    for (auto &b: blocks)  {
+	auto start = b.Addr();
+	auto end = b.EndAddr();
+	if (start > rangeEnd || rangeEnd == rangeStart)  {
+	    addRange();
+	    rangeStart = start;
+	}
+	rangeEnd = max(rangeEnd, end);
+    }
+    addRange();
+
+    state.codeHash = CodeHash(cs, state.entry, state.codeRanges);
+
+    return state;
+}
+
+
+// Returns the function's record, and if withState also what is needed to
+// reuse it in a later run.
+FunctionState FunctionSummary::Result(bool withState) const
+{
+    if (withState)  {
+	return State();
+    }
+
+    FunctionState state;
+    state.record = Record();
+    state.entry = function->addr();
+    return state;
+}
+
+
+void FunctionSummary::WriteJson(JsonWriter &writer) const
+{
+    Record().WriteJson(writer);
 }
 
 
@@ -794,6 +1420,61 @@ std::string RegionTypeName(Dyninst::ParseAPI::CodeRegion *r)
     }
 }
 
+// Finds the regions and the callees:  the entry block of each function.
+// Must be called after parsing and before the functions are summarized.
+// Finds the callees of the functions parsed, and if symbolNames is not null
+// of the other entries in it, named by their first (mangled) name as
+// ParseAPI would.
+void CalleeTable::Build(Dyninst::ParseAPI::CodeObject *co, RecordNames &names,
+	const std::map<Address, std::vector<std::string>> *symbolNames)
+{
+    using namespace std;
+
+    regions.clear();
+    callees.clear();
+    symbolCallees.clear();
+    for (auto r: co->cs()->regions())  {
+	auto &region = regions[r];
+	region.name = RegionName(r);
+	region.isPlt = (region.name.find(".plt") != string::npos);
+    }
+
+    vector<ParseAPI::Function *> funcs;
+    for (auto f: co->funcs())  {
+	auto entry = f->entry();
+	if (!entry || callees.count(entry))  {
+	    continue;
+	}
+	auto &callee = callees[entry];
+	funcs.clear();
+	auto i = back_inserter(funcs);
+	entry->getFuncs(i);
+	for (auto g: funcs)  {
+	    auto region = FindRegion(g->region());
+	    callee.isToPlt |= region ? region->isPlt : FunctionSummary::IsPltRegion(g);
+	    callee.names.push_back(names.Add(g->name()));
+	}
+    }
+
+    if (!symbolNames)  {
+	return;
+    }
+    for (auto &known: *symbolNames)  {
+	if (known.second.empty())  {
+	    continue;
+	}
+	auto &callee = symbolCallees[known.first];
+	callee.names.push_back(names.Add(known.second.front()));
+	for (auto &r: regions)  {
+	    if (r.first->contains(known.first))  {
+		callee.isToPlt = r.second.isPlt;
+		break;
+	    }
+	}
+    }
+}
+
+
 //using namespace Dyninst;
 //using namespace Dyninst::ParseAPI;
 using namespace Dyninst::InstructionAPI;
@@ -839,6 +1520,91 @@ void Options::ProcessOptions(int argc, char **argv)
 		indent = 0;
 	    }  else if (!strcmp("--all-calls", arg))  {
 		onlyToPltCalls = false;
+	    }  else if (!strcmp("--interprocedural", arg))  {
+		interprocedural = true;
+	    }  else if (!strcmp("--exported", arg))  {
+		selection.SelectExported();
+	    }  else if (!strcmp("--reachable", arg))  {
+		reachable = true;
+	    }  else if (!strcmp("--dependencies", arg))  {
+		dependencies = true;
+	    }  else if (!strcmp("--timing", arg))  {
+		timing = true;
+	    }  else if (!strcmp("--stats", arg))  {
+		stats = true;
+	    }  else if (!strncmp("--stats=", arg, 8))  {
+		stats = true;
+		statsFile = arg + 8;
+	    }  else if (auto value = OptionArg("--format", i, argc, argv))  {
+		if (!strcmp("json", value) || !strcmp("binary", value))  {
+		    binaryOutput = !strcmp("binary", value);
+		}  else  {
+		    failed = true;
+		    failureMsg += string{"Unknown format for --format: "} + value + '\n';
+		}
+	    }  else if (auto value = OptionArg("--compress", i, argc, argv))  {
+		if (!CompressingStreambuf::ParseSpec(value, compression, compressionLevel))  {
+		    failed = true;
+		    failureMsg += string{"Invalid value for --compress: "} + value + '\n';
+		}
+		compressionGiven = true;
+	    }  else if (auto value = OptionArg("--serve", i, argc, argv))  {
+		serveSocket = value;
+	    }  else if (auto value = OptionArg("--serve-memory", i, argc, argv))  {
+		serveMemory = SizeArg("--serve-memory", value);
+	    }  else if (auto value = OptionArg("--serve-clients", i, argc, argv))  {
+		serveClients = CountArg("--serve-clients", value);
+		if (serveClients == 0)  {
+		    failed = true;
+		    failureMsg += "--serve-clients has to be at least 1\n";
+		}
+	    }  else if (auto value = OptionArg("--batch", i, argc, argv))  {
+		batchList = value;
+	    }  else if (auto value = OptionArg("--batch-dir", i, argc, argv))  {
+		batchDir = value;
+	    }  else if (auto value = OptionArg("--cache-dir", i, argc, argv))  {
+		cacheDir = value;
+	    }  else if (auto value = OptionArg("--cache-max-size", i, argc, argv))  {
+		cacheMaxSize = SizeArg("--cache-max-size", value);
+	    }  else if (auto value = OptionArg("--save-state", i, argc, argv))  {
+		saveState = value;
+	    }  else if (auto value = OptionArg("--previous-state", i, argc, argv))  {
+		previousState = value;
+	    }  else if (auto value = OptionArg("--index", i, argc, argv))  {
+		indexFile = value;
+	    }  else if (auto value = OptionArg("--function", i, argc, argv))  {
+		selection.AddName(value);
+	    }  else if (auto value = OptionArg("--function-regex", i, argc, argv))  {
+		if (!selection.AddRegex(value))  {
+		    failed = true;
+		    failureMsg += string{"Invalid regular expression for --function-regex: "} + value + '\n';
+		}
+	    }  else if (auto value = OptionArg("--address-range", i, argc, argv))  {
+		if (!selection.AddRange(value))  {
+		    failed = true;
+		    failureMsg += string{"Invalid range for --address-range: "} + value + '\n';
+		}
+	    }  else if (auto value = OptionArg("--section", i, argc, argv))  {
+		selection.AddSection(value);
+	    }  else if (auto value = OptionArg("--sysroot", i, argc, argv))  {
+		sysroot = value;
+	    }  else if (auto value = OptionArg("--library-path", i, argc, argv))  {
+		for (const char *dir = value; *dir; )  {
+		    auto len = strcspn(dir, ":");
+		    if (len > 0)  {
+			libraryPath.emplace_back(dir, len);
+		    }
+		    dir += len + (dir[len] == ':');
+		}
+	    }  else if (auto value = OptionArg("--max-memory", i, argc, argv))  {
+		maxMemory = SizeArg("--max-memory", value);
+	    }  else if (auto value = OptionArg("--parse-threads", i, argc, argv))  {
+		parseThreads = CountArg("--parse-threads", value);
+	    }  else if (auto value = OptionArg("--jobs", i, argc, argv))  {
+		jobs = CountArg("--jobs", value);
+		if (jobs == 0)  {
+		    jobs = WorkStealingPool::HardwareThreads();
+		}
 	    }  else  {
 		failed = true;
 		failureMsg += "Unknown option ";
@@ -852,8 +1618,57 @@ void Options::ProcessOptions(int argc, char **argv)
     
     if (help)  {
 	clog << "Usage: " << programName << " [options] infile [outfile]\n"
+	    << "       " << programName << " [options] --batch LIST | --batch-dir DIR [outfile]\n"
+	    << "       " << programName << " query INDEX COMMAND ARGS...\n"
 	    << "  --compact-json   minify json output\n"
+	    << "  --format FORMAT  write the output as json (default) or binary records\n"
+	    << "  --compress CODEC[:LEVEL]\n"
+	    << "                   compress the output with gzip, zstd or none (default\n"
+	    << "                   from the outfile's extension, .gz or .zst)\n"
+	    << "  --index FILE     write an index of the call sites to FILE for query\n"
 	    << "  --all-calls      include all calls to non-external functions\n"
+	    << "  --function NAME  only analyze the function named NAME (mangled or not)\n"
+	    << "  --function-regex REGEX\n"
+	    << "                   only analyze the functions with a name matching REGEX\n"
+	    << "  --address-range START[-END]\n"
+	    << "                   only analyze the functions with an entry in the range\n"
+	    << "  --section NAME   only analyze the functions in section NAME\n"
+	    << "  --exported       only analyze the functions with an exported symbol\n"
+	    << "  --reachable      analyze the functions reachable by calls from those\n"
+	    << "                   selected instead\n"
+	    << "  --interprocedural\n"
+	    << "                   report the registers set before each call, using\n"
+	    << "                   summaries of the registers internal calls clobber\n"
+	    << "  --jobs N         summarize functions using N threads (0 = all cores)\n"
+	    << "  --parse-threads N\n"
+	    << "                   parse the binary using N threads (default OpenMP's)\n"
+	    << "  --timing         report the time to parse and summarize to stderr\n"
+	    << "  --stats[=FILE]   write statistics as json to FILE (default stderr)\n"
+	    << "  --max-memory SIZE\n"
+	    << "                   trade speed to keep memory use under SIZE bytes (K, M,\n"
+	    << "                   G suffix) and report the peak memory use to stderr\n"
+	    << "  --dependencies   also analyze the shared libraries needed, and resolve\n"
+	    << "                   calls to the PLT to their library (json lines output)\n"
+	    << "  --sysroot DIR    find the shared libraries needed under DIR\n"
+	    << "  --library-path DIRS\n"
+	    << "                   search the : separated DIRS first for libraries\n"
+	    << "  --batch LIST     analyze the binaries listed in file LIST (- for stdin)\n"
+	    << "  --batch-dir DIR  analyze the ELF files found in directory DIR\n"
+	    << "  --serve SOCKET   keep binaries parsed and answer requests for them on\n"
+	    << "                   the Unix domain socket SOCKET\n"
+	    << "  --serve-memory SIZE\n"
+	    << "                   keep binaries parsed in about SIZE bytes (K, M, G\n"
+	    << "                   suffix; default 4G)\n"
+	    << "  --serve-clients N\n"
+	    << "                   answer at most N clients at a time (default 16)\n"
+	    << "  --cache-dir DIR  reuse results stored in directory DIR\n"
+	    << "  --cache-max-size SIZE\n"
+	    << "                   limit the cache to SIZE bytes (K, M, G suffix; 0 = no\n"
+	    << "                   limit; default 1G)\n"
+	    << "  --save-state FILE\n"
+	    << "                   save what is needed to reuse the results in FILE\n"
+	    << "  --previous-state FILE\n"
+	    << "                   reuse the results of unchanged functions from FILE\n"
 	    << "  --help           print this message and exit\n"
 	    << "  --version        print version and exit\n";
 	exit(0);
@@ -864,14 +1679,66 @@ void Options::ProcessOptions(int argc, char **argv)
 	exit(0);
     }
 
-    if (args.size() < 1)  {
+    if (interprocedural && (saveState || previousState))  {
 	failed = true;
-	failureMsg += "binary input argument not specified\n";
+	failureMsg += "State files are not supported with --interprocedural\n";
     }
 
-    if (args.size() > 2)  {
+    if (!selection.Empty() && (saveState || previousState))  {
 	failed = true;
-	failureMsg += "Only two arguments are allowd\n";
+	failureMsg += "State files are not supported with a function selection\n";
+    }
+
+    if (reachable && selection.Empty())  {
+	failed = true;
+	failureMsg += "--reachable requires a function selection for the roots\n";
+    }
+
+    if (batchList || batchDir || dependencies)  {
+	if ((batchList || batchDir) && args.size() > 1)  {
+	    failed = true;
+	    failureMsg += "Only an output argument is allowed in batch mode\n";
+	}
+	if (saveState || previousState)  {
+	    failed = true;
+	    failureMsg += "State files are not supported in batch mode\n";
+	}
+	if (binaryOutput)  {
+	    failed = true;
+	    failureMsg += "Batch mode only writes json\n";
+	}
+	if (indexFile)  {
+	    failed = true;
+	    failureMsg += "Index files are not supported in batch mode\n";
+	}
+	if (stats)  {
+	    failed = true;
+	    failureMsg += "--stats is not supported in batch mode\n";
+	}
+    }
+    if (serveSocket)  {
+	if (batchList || batchDir || dependencies || !args.empty())  {
+	    failed = true;
+	    failureMsg += "--serve takes no binaries, they are given by the requests\n";
+	}
+	if (saveState || previousState || indexFile || !selection.Empty())  {
+	    failed = true;
+	    failureMsg += "State files, index files and function selections are not supported with --serve\n";
+	}
+	if (binaryOutput || compressionGiven || stats || cacheDir)  {
+	    failed = true;
+	    failureMsg += "--serve only answers with json lines, and does not cache or report statistics\n";
+	}
+    }  else if (!batchList && !batchDir)  {
+	if (args.size() < 1)  {
+	    failed = true;
+	    failureMsg += "binary input argument not specified\n";
+	}
+
+	if (args.size() > 2)  {
+	    failed = true;
+	    failureMsg += "Only two arguments are allowd\n";
+	}
     }
 
     if (failed)  {
@@ -880,6 +1747,113 @@ void Options::ProcessOptions(int argc, char **argv)
 }
 
 
+// Returns the value of the option name if argv[i] is the option, either as
+// "name=value" or as "name value" in which case i is advanced past the value.
+// Returns nullptr if argv[i] is not the option.
+const char *Options::OptionArg(const char *name, int &i, int argc, char **argv)
+{
+    using namespace std;
+
+    const char *arg = argv[i];
+    auto len = strlen(name);
+    if (strncmp(name, arg, len))  {
+	return nullptr;
+    }
+
+    if (arg[len] == '=')  {
+	return arg + len + 1;
+    }  else if (arg[len] != '\0')  {
+	return nullptr;
+    }
+
+    if (i + 1 >= argc)  {
+	failed = true;
+	failureMsg += string{"Missing value for option "} + name + '\n';
+	return emptyString;
+    }
+
+    return argv[++i];
+}
+
+
+unsigned Options::CountArg(const char *name, const char *value)
+{
+    using namespace std;
+
+    char *end;
+    auto n = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0')  {
+	failed = true;
+	failureMsg += string{"Invalid number for option "} + name + ": '" + value + "'\n";
+	return 0;
+    }
+
+    return n;
+}
+
+
+// Returns the size, a number with an optional K, M or G (power of 2) suffix.
+uint64_t Options::SizeArg(const char *name, const char *value)
+{
+    using namespace std;
+
+    char *end;
+    uint64_t n = strtoull(value, &end, 10);
+    switch (toupper(*end))  {
+	case 'G':
+	    n <<= 10;
+	    // fall through
+	case 'M':
+	    n <<= 10;
+	    // fall through
+	case 'K':
+	    n <<= 10;
+	    ++end;
+	    break;
+	default:
+	    break;
+    }
+
+    if (*value == '\0' || *end != '\0')  {
+	failed = true;
+	failureMsg += string{"Invalid size for option "} + name + ": '" + value + "'\n";
+	return 0;
+    }
+
+    return n;
+}
+
+
+// Returns a string identifying the program version and the options that
+// change the function records, so records for different options are not
+// mixed up.  A function selection is included as the hash of its
+// description.
+std::string Options::RecordSignature() const
+{
+    auto selected = selection.Description();
+
+    return "call_analyzer " + programVersion
+	    + " onlyToPltCalls=" + std::to_string(onlyToPltCalls)
+	    + (interprocedural ? " interprocedural=1" : "")
+	    + (selected.empty() ? "" : " selection=" + Sha256::HexDigest(selected))
+	    + (reachable ? " reachable=1" : "")
+	    + (dependencies ? " dependencies=1" : "");
+}
+
+
+// Returns the RecordSignature with the options that change how the records
+// are written, so results for different options are cached separately.
+// jsonStrings is the revision of JsonWriter's string escaping.
+std::string Options::OutputSignature(bool binary, int outputIndent) const
+{
+    if (binary)  {
+	return RecordSignature() + " format=binary" + std::to_string(RecordFileReader::version);
+    }
+
+    return RecordSignature() + " indent=" + std::to_string(outputIndent) + " jsonStrings=2";
+}
+
+
 void Options::Error(const std::string &msg)  {
     using namespace std;
     clog << "ERROR: " << programName << "\n" << msg << endl;
@@ -888,45 +1862,2255 @@ void Options::Error(const std::string &msg)  {
 
 
 
-int main(int argc, char **argv)
+// Measures the wall clock time since construction or the last Restart.
+class Stopwatch
+{
+    public:
+	Stopwatch()
+	    : start(std::chrono::steady_clock::now())
+	    {}
+	void Restart()
+	{
+	    start = std::chrono::steady_clock::now();
+	}
+	double Seconds() const
+	{
+	    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+	    return d.count();
+	}
+    private:
+	std::chrono::steady_clock::time_point	start;
+};
+
+
+// A function to write:  either a ParseAPI function to summarize, or the
+// record of an unchanged function reused from a previous run.
+struct OutputFunction
+{
+    Address			entry;
+    Dyninst::ParseAPI::Function	*func = nullptr;
+    FunctionState		reused;
+};
+
+
+// Writes a function's record (state.record) to the output.  state.entry is
+// always set, the rest of the state only if it was requested.
+using RecordSink = std::function<void(const FunctionState &)>;
+
+
+// Adds the function's instructions, and the seconds it took to summarize
+// it, to --stats.
+void AddFunctionStats(const FunctionSummary &fsum, double seconds)
+{
+    if (!runStats.enabled)  {
+	return;
+    }
+
+    runStats.instructions += fsum.NumInstructions();
+    if (runStats.slowest.IsSlowest(seconds))  {
+	runStats.slowest.Add({seconds, fsum.FunctionName(), fsum.EntryAddr(), fsum.NumBlocks()});
+    }
+}
+
+
+// Returns the function's record, and if withState also what is needed to
+// reuse it in a later run.
+FunctionState SummarizeFunction(Dyninst::ParseAPI::Function *f, bool withState, BinaryTables *tables)
+{
+    Stopwatch stopwatch;
+    FunctionSummary fsum(f, nullptr, tables);
+    auto state = fsum.Result(withState);
+    AddFunctionStats(fsum, stopwatch.Seconds());
+
+    return state;
+}
+
+
+// Builds the call graph of the functions.  The summaries are all empty.
+CalleeSummaries::CalleeSummaries(const std::vector<OutputFunction> &funcs)
+    :
+	callsUnknown(funcs.size()),
+	clobbered(funcs.size())
 {
     using namespace std;
-    using namespace Dyninst;
-    using namespace Dyninst::ParseAPI;
-    using namespace Dyninst::InstructionAPI;
 
-    options.ProcessOptions(argc, argv);
+    for (Node i = 0; i < funcs.size(); ++i)  {
+	auto f = funcs[i].func;
+	if (f && !FunctionSummary::IsPltRegion(f))  {
+	    nodes.emplace(f, i);
+	}
+    }
 
-    if (argc < 2)  {
-	return 1;
+    vector<pair<Node, Node>> edges;
+    vector<Node> callees;
+    for (Node i = 0; i < funcs.size(); ++i)  {
+	auto f = funcs[i].func;
+	if (!f || nodes.find(f) == nodes.end())  {
+	    callsUnknown[i] = true;
+	    continue;
+	}
+	for (auto b: f->blocks())  {
+	    callees.clear();
+	    if (!AddCallees(b, true, callees))  {
+		callsUnknown[i] = true;
+	    }
+	    for (auto c: callees)  {
+		edges.emplace_back(i, c);
+	    }
+	}
     }
+    callGraph.Build(funcs.size(), edges);
+}
 
-    auto sts = new ParseAPI::SymtabCodeSource(options.args[0]);
-    auto co = new ParseAPI::CodeObject(sts);
 
-    co->parse();
+// Returns the registers the call at the end of callBlock may clobber, or
+// unknown if a callee is not known.
+RegisterMask CalleeSummaries::CallClobbered(Block *callBlock, const RegisterMask &unknown) const
+{
+    std::vector<Node> callees;
+    if (!AddCallees(callBlock, false, callees) || callees.empty())  {
+	return unknown;
+    }
 
-    auto allFuncs = co->funcs();
+    RegisterMask regs;
+    for (auto c: callees)  {
+	regs |= clobbered[c];
+    }
 
-    std::ostream *jsonFile = &cout;
-    std::ofstream outputFile;
-    if (options.args.size() > 1)  {
-	outputFile.open(options.args[1]);
-	if (!outputFile)  {
-	    options.Error(string{"Error opening output file '"} + options.args[1] + "'\n");
+    return regs;
+}
+
+
+// Adds the functions the block calls, and if withJumps the functions it
+// jumps to (tail calls), to callees.  Returns false if it may call or jump
+// to code that is not one of the functions.
+bool CalleeSummaries::AddCallees(Block *b, bool withJumps, std::vector<Node> &callees) const
+{
+    using namespace std;
+
+    bool known = true;
+    for (auto e: b->targets())  {
+	auto type = e->type();
+	if (type == ParseAPI::RET || type == ParseAPI::CALL_FT)  {
+	    continue;
+	}
+	if (e->sinkEdge())  {
+	    // an unresolved call, or a jump that may leave the function
+	    known &= !(type == ParseAPI::CALL || withJumps);
+	    continue;
+	}
+	if (type != ParseAPI::CALL && !(withJumps && e->interproc()))  {
+	    continue;
+	}
+
+	vector<Function *> funcs;
+	auto i = back_inserter(funcs);
+	e->trg()->getFuncs(i);
+	known &= !funcs.empty();
+	for (auto f: funcs)  {
+	    auto n = nodes.find(f);
+	    if (n != nodes.end())  {
+		callees.push_back(n->second);
+	    }  else  {
+		known = false;
+	    }
 	}
-	jsonFile = &outputFile;
     }
 
-    JsonWriter writer(*jsonFile, options.indent);
-    writer.OpenObject();
-    writer.AddMemberKey("functions");
-    writer.OpenArray();
-    for (auto f: allFuncs)  {
-	FunctionSummary fsum(f);
-	fsum.WriteJson(writer);
+    return known;
+}
+
+
+// Writes the functions in order, using callee summaries (--interprocedural).
+// The registers each function may clobber are summarized bottom-up over the
+// strongly connected components of the call graph:  the functions of a
+// component are summarized together once the components they call are, and
+// the component's summary is the union of the registers they write and the
+// summaries of the components they call.  Components are grouped into
+// levels by the longest chain of calls below them, so the components of a
+// level are independent and are summarized on numThreads worker threads,
+// largest (by number of blocks) first.  The results are held until the last
+// level is done, then written in order.
+void WriteInterproceduralFunctions(
+	const RecordSink &sink,
+	std::vector<OutputFunction> &funcs,
+	unsigned numThreads,
+	std::ostream *stateOut,
+	BinaryTables *tables
+    )
+{
+    using namespace std;
+    using Node = DataflowGraph::Node;
+
+    CalleeSummaries summaries(funcs);
+    auto &callGraph = summaries.CallGraph();
+    vector<Node> component;
+    auto numComponents = callGraph.Components(component);
+
+    // a component's level is 0 if it calls no other component, otherwise
+    // one more than the highest level it calls; callees have lower numbers
+    vector<vector<Node>> members(numComponents);
+    vector<size_t> numBlocks(numComponents);
+    for (Node i = 0; i < funcs.size(); ++i)  {
+	if (auto f = funcs[i].func)  {
+	    auto blocks = f->blocks();
+	    members[component[i]].push_back(i);
+	    numBlocks[component[i]] += distance(blocks.begin(), blocks.end());
+	}
+    }
+    vector<size_t> level(numComponents);
+    vector<vector<Node>> levels;
+    for (Node c = 0; c < numComponents; ++c)  {
+	if (members[c].empty())  {
+	    continue;
+	}
+	for (auto i: members[c])  {
+	    for (auto callee: callGraph.Successors(i))  {
+		if (component[callee] != c)  {
+		    level[c] = max(level[c], level[component[callee]] + 1);
+		}
+	    }
+	}
+	if (level[c] >= levels.size())  {
+	    levels.resize(level[c] + 1);
+	}
+	levels[level[c]].push_back(c);
+    }
+
+    vector<FunctionState> results(funcs.size());
+    auto summarize = [&](Node c)  {
+	vector<unique_ptr<FunctionSummary>> fsums;
+	vector<double> seconds;
+	RegisterMask clobbered;
+	for (auto i: members[c])  {
+	    Stopwatch stopwatch;
+	    fsums.emplace_back(new FunctionSummary(funcs[i].func, &summaries, tables));
+	    seconds.push_back(stopwatch.Seconds());
+	    clobbered |= fsums.back()->WrittenRegs();
+	    if (summaries.CallsUnknown(i))  {
+		clobbered |= fsums.back()->CallClobberedRegisters();
+	    }
+	    for (auto callee: callGraph.Successors(i))  {
+		clobbered |= summaries.Clobbered(callee);
+	    }
+	}
+	for (auto i: members[c])  {
+	    summaries.SetClobbered(i, clobbered);
+	}
+	for (size_t k = 0; k < fsums.size(); ++k)  {
+	    Stopwatch stopwatch;
+	    fsums[k]->PropagateStartRegs();
+	    results[members[c][k]] = fsums[k]->Result(stateOut != nullptr);
+	    AddFunctionStats(*fsums[k], seconds[k] + stopwatch.Seconds());
+	    fsums[k].reset();
+	}
+    };
+
+    for (auto &components: levels)  {
+	stable_sort(components.begin(), components.end(), [&](Node a, Node b)  {
+	    return numBlocks[a] > numBlocks[b];
+	});
+	if (numThreads <= 1 || components.size() == 1)  {
+	    for (auto c: components)  {
+		summarize(c);
+	    }
+	}  else  {
+	    WorkStealingPool pool(min<size_t>(numThreads, components.size()));
+	    pool.Start(components.size(), [&](size_t taskId)  {
+		summarize(components[taskId]);
+	    });
+	    pool.Wait();
+	}
+    }
+
+    for (size_t i = 0; i < funcs.size(); ++i)  {
+	auto &state = funcs[i].func ? results[i] : funcs[i].reused;
+	sink(state);
+	if (stateOut)  {
+	    state.Write(*stateOut);
+	}
+	state = FunctionState{};
+    }
+}
+
+
+// Writes the functions in order.  With more than one thread the functions
+// are summarized on numThreads worker threads and the results are put back
+// in order so the output is identical to the serial loop.  At most a window
+// of numThreads * 4 results are held ahead of the output; within each
+// window's worth of functions the largest (by number of blocks) are started
+// first.  If stateOut is not null the state of each function is also
+// written to it.  A reused record is released once it is written.  The
+// workers share the tables of the binary.  If writing fails the functions
+// not yet started are skipped.
+//
+// With --max-memory the functions are summarized in order.  Every
+// memoryCheckInterval functions, if the process is over the limit, the
+// memory freed by the summaries is given back to the system, and if it is
+// still over the window is halved (down to 1, so a single result is held).
+// When under half the limit the window grows again.
+void WriteFunctions(
+	const RecordSink &sink,
+	std::vector<OutputFunction> &funcs,
+	unsigned numThreads,
+	std::ostream *stateOut,
+	BinaryTables *tables
+    )
+{
+    using namespace std;
+
+    auto write = [&](const FunctionState &state)  {
+	sink(state);
+	if (stateOut)  {
+	    state.Write(*stateOut);
+	}
+    };
+
+    const size_t memoryCheckInterval = 64;
+    const size_t maxWindow = size_t(numThreads) * 4;
+    auto checkMemory = [&](size_t numWritten, ReorderBuffer<FunctionState> *results)  {
+	if (!options.maxMemory || numWritten % memoryCheckInterval != 0)  {
+	    return;
+	}
+	auto rss = MemoryUsage::CurrentRss();
+	if (rss > options.maxMemory)  {
+	    MemoryUsage::ReleaseFreeMemory();
+	    rss = MemoryUsage::CurrentRss();
+	}
+	if (results)  {
+	    auto window = results->Window();
+	    if (rss > options.maxMemory)  {
+		window = max<size_t>(1, window / 2);
+	    }  else if (rss < options.maxMemory / 2)  {
+		window = min(maxWindow, window * 2);
+	    }
+	    results->SetWindow(window);
+	}
+    };
+
+    if (numThreads <= 1)  {
+	for (size_t i = 0; i < funcs.size(); ++i)  {
+	    auto &f = funcs[i];
+	    if (f.func)  {
+		write(SummarizeFunction(f.func, stateOut != nullptr, tables));
+	    }  else  {
+		write(f.reused);
+		f.reused = FunctionState{};
+	    }
+	    checkMemory(i + 1, nullptr);
+	}
+	return;
+    }
+
+    vector<size_t> schedule;
+    vector<size_t> numBlocks(funcs.size());
+    for (size_t i = 0; i < funcs.size(); ++i)  {
+	if (auto f = funcs[i].func)  {
+	    auto blocks = f->blocks();
+	    numBlocks[i] = distance(blocks.begin(), blocks.end());
+	    schedule.push_back(i);
+	}
+    }
+    if (schedule.empty())  {
+	for (auto &f: funcs)  {
+	    write(f.reused);
+	    f.reused = FunctionState{};
+	}
+	return;
+    }
+    // the nth scheduled function is the nth result taken, its rank
+    vector<size_t> rank(funcs.size());
+    for (size_t n = 0; n < schedule.size(); ++n)  {
+	rank[schedule[n]] = n;
+    }
+    if (!options.maxMemory)  {
+	// largest first, reordered only within a window so the next result
+	// taken is always being produced
+	for (size_t n = 0; n < schedule.size(); n += maxWindow)  {
+	    auto end = schedule.begin() + min(schedule.size(), n + maxWindow);
+	    stable_sort(schedule.begin() + n, end, [&](size_t a, size_t b)  {
+		return numBlocks[a] > numBlocks[b];
+	    });
+	}
+    }
+
+    ReorderBuffer<FunctionState> results(funcs.size());
+    results.SetWindow(maxWindow);
+    WorkStealingPool pool(numThreads);
+    pool.Start(schedule.size(), [&](size_t taskId)  {
+	auto i = schedule[taskId];
+	try  {
+	    if (results.WaitForRoom(rank[i]))  {
+		results.Put(i, SummarizeFunction(funcs[i].func, stateOut != nullptr, tables));
+	    }
+	}  catch (...)  {
+	    results.PutError(i, current_exception());
+	}
+    });
+
+    try  {
+	for (size_t i = 0; i < funcs.size(); ++i)  {
+	    if (funcs[i].func)  {
+		write(results.Take(i));
+	    }  else  {
+		write(funcs[i].reused);
+		funcs[i].reused = FunctionState{};
+	    }
+	    checkMemory(i + 1, &results);
+	}
+    }  catch (...)  {
+	// the workers skip what they have not started, and the pool's
+	// destructor waits for the rest
+	results.Cancel();
+	throw;
+    }
+
+    pool.Wait();
+}
+
+
+// The functions of a previous run read from a state file.
+class PreviousState
+{
+    public:
+	void Read(const std::string &path, const std::string &signature);
+	bool AllHaveSymbols() const;
+	const FunctionState *Match(
+		Address entry,
+		const std::vector<std::string> &names,
+		Dyninst::ParseAPI::CodeSource *cs,
+		const std::map<Address, std::vector<std::string>> &knownNames
+		) const;
+    private:
+	std::vector<FunctionState>			funcs;
+	std::unordered_multimap<std::string, size_t>	byName;
+	std::shared_ptr<RecordNames>			names = std::make_shared<RecordNames>();
+};
+
+
+void PreviousState::Read(const std::string &path, const std::string &signature)
+{
+    std::ifstream in(path);
+    if (!in)  {
+	throw std::runtime_error{"unable to open state file '" + path + "'"};
+    }
+    if (!StateFile::ReadHeader(in, signature))  {
+	throw std::runtime_error{"state file '" + path + "' is not from this version or these options"};
+    }
+
+    FunctionState state;
+    while (state.Read(in, names))  {
+	byName.emplace(state.record.name, funcs.size());
+	funcs.push_back(std::move(state));
+    }
+    if (!in.eof())  {
+	throw std::runtime_error{"malformed state file '" + path + "'"};
+    }
+}
+
+
+// Returns true if every function was found from a symbol or PLT entry, so
+// all of them can be found in the new binary without parsing it.
+bool PreviousState::AllHaveSymbols() const
+{
+    for (auto &f: funcs)  {
+	if (!f.hasSymbol)  {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+
+// Returns the previous state of the function at entry known by names if its
+// code is identical and its calls are to functions with the same names
+// after adjusting for the function's move, or nullptr.  knownNames are the
+// names of the functions in the new binary by entry address.
+const FunctionState *PreviousState::Match(
+	Address entry,
+	const std::vector<std::string> &names,
+	Dyninst::ParseAPI::CodeSource *cs,
+	const std::map<Address, std::vector<std::string>> &knownNames
+    ) const
+{
+    using namespace std;
+
+    for (auto &name: names)  {
+	auto range = byName.equal_range(name);
+	for (auto i = range.first; i != range.second; ++i)  {
+	    auto &prev = funcs[i->second];
+	    if (prev.codeHash.empty() || CodeHash(cs, entry, prev.codeRanges) != prev.codeHash)  {
+		continue;
+	    }
+
+	    bool sameCallees = true;
+	    auto delta = entry - prev.entry;
+	    for (auto &call: prev.record.calls)  {
+		if (call.calledAddr == noRecordAddress)  {
+		    continue;
+		}
+		auto known = knownNames.find(call.calledAddr + delta);
+		for (auto id: call.funcNames)  {
+		    auto &callName = prev.record.names->Name(id);
+		    if (known == knownNames.end()
+			    || find(known->second.begin(), known->second.end(), callName) == known->second.end())  {
+			sameCallees = false;
+		    }
+		}
+	    }
+	    if (sameCallees)  {
+		return &prev;
+	    }
+	}
+    }
+
+    return nullptr;
+}
+
+
+// Returns true if the function has a global or weak symbol in the dynamic
+// symbol table that is visible outside the binary.
+bool IsExported(Dyninst::SymtabAPI::Function *f)
+{
+    using namespace Dyninst::SymtabAPI;
+
+    std::vector<Symbol *> syms;
+    f->getSymbols(syms);
+    for (auto sym: syms)  {
+	auto linkage = sym->getLinkage();
+	auto visibility = sym->getVisibility();
+	if (sym->isInDynSymtab() && (linkage == Symbol::SL_GLOBAL || linkage == Symbol::SL_WEAK)
+		&& visibility != Symbol::SV_HIDDEN && visibility != Symbol::SV_INTERNAL)  {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+
+// Returns the code region containing addr, or nullptr.
+Dyninst::ParseAPI::CodeRegion *RegionContaining(Dyninst::ParseAPI::CodeSource *cs, Address addr)
+{
+    for (auto r: cs->regions())  {
+	if (r->contains(addr))  {
+	    return r;
+	}
+    }
+
+    return nullptr;
+}
+
+
+// Returns the previous state moved to entry in the new binary.
+FunctionState MoveState(const FunctionState &prev, Address entry, Dyninst::ParseAPI::CodeRegion *region)
+{
+    auto state = prev;
+    auto delta = entry - prev.entry;
+    state.entry = entry;
+    state.record.addr = region->low();
+    state.record.section = RegionName(region);
+    state.record.isInPlt = (state.record.section.find(".plt") != std::string::npos);
+    for (auto &call: state.record.calls)  {
+	if (call.callInsnAddr != noRecordAddress)  {
+	    call.callInsnAddr += delta;
+	}
+	if (call.calledAddr != noRecordAddress)  {
+	    call.calledAddr += delta;
+	}
+    }
+
+    return state;
+}
+
+
+// Sets the library and address each call to the PLT resolves to in the
+// object's scope, using the first of the call's function names defined.
+void ResolvePltCalls(FunctionRecord &record, const SharedLibraries::Object &object)
+{
+    for (auto &call: record.calls)  {
+	if (!call.isToPlt)  {
+	    continue;
+	}
+	for (auto id: call.funcNames)  {
+	    uint64_t addr;
+	    if (auto library = SharedLibraries::Resolve(object, record.names->Name(id), addr))  {
+		call.library = library->path;
+		call.libraryAddr = addr;
+		break;
+	    }
+	}
+    }
+}
+
+
+// The Dyninst objects for one binary.  The constructor throws
+// std::runtime_error if the file can not be opened as an object file.
+class BinaryAnalysis
+{
+    public:
+	using Function = Dyninst::ParseAPI::Function;
+
+	BinaryAnalysis(const std::string &path);
+	~BinaryAnalysis();
+	BinaryAnalysis(const BinaryAnalysis &) = delete;
+	BinaryAnalysis &operator=(const BinaryAnalysis &) = delete;
+	void Parse();
+	void ParseIncremental(const PreviousState &previous);
+	const std::vector<OutputFunction> &Functions() const
+	{
+	    return funcs;
+	}
+	size_t NumBlocks() const;
+	size_t NumReused() const;
+	const BlockCache &SharedBlocks() const
+	{
+	    return tables.blockCache;
+	}
+	void WriteRecords(const RecordSink &sink, unsigned jobs, std::ostream *stateOut = nullptr)
+	{
+	    WriteRecords(sink, funcs, jobs, stateOut);
+	}
+	void WriteSelectedRecords(const RecordSink &sink, unsigned jobs,
+		const std::vector<size_t> &indexes);
+	void WriteJsonFunctions(JsonWriter &writer, unsigned jobs,
+		const SharedLibraries::Object *object = nullptr);
+    private:
+	void ParseSelected(const FunctionSelection &selection, bool reachable);
+	std::map<Address, std::vector<std::string>> SymbolNames(bool withPrettyNames,
+		std::set<Address> *exported = nullptr) const;
+	static std::vector<Function *> Reachable(const std::vector<Function *> &roots);
+	void SortFunctions();
+	void WriteRecords(const RecordSink &sink, std::vector<OutputFunction> &written,
+		unsigned jobs, std::ostream *stateOut);
+
+	Dyninst::SymtabAPI::Symtab		*symtab = nullptr;
+	Dyninst::ParseAPI::SymtabCodeSource	*codeSource = nullptr;
+	Dyninst::ParseAPI::CodeObject		*codeObject = nullptr;
+	std::vector<OutputFunction>		funcs;
+	BinaryTables				tables;
+	bool					calleesBuilt = false;
+	// names of the callees that are not parsed (ParseSelected)
+	std::map<Address, std::vector<std::string>>	symbolNames;
+};
+
+
+BinaryAnalysis::BinaryAnalysis(const std::string &path)
+{
+    using namespace Dyninst;
+
+    PhaseTimer timer(runStats.Phase(runStats.symtabLoad), true);
+
+    if (!SymtabAPI::Symtab::openFile(symtab, path))  {
+	throw std::runtime_error{"unable to open object file '" + path + "'"};
+    }
+    codeSource = new ParseAPI::SymtabCodeSource(symtab);
+    codeObject = new ParseAPI::CodeObject(codeSource);
+}
+
+
+BinaryAnalysis::~BinaryAnalysis()
+{
+    delete codeObject;
+    delete codeSource;
+    Dyninst::SymtabAPI::Symtab::closeSymtab(symtab);
+}
+
+
+void BinaryAnalysis::Parse()
+{
+    if (!options.selection.Empty())  {
+	ParseSelected(options.selection, options.reachable);
+	return;
+    }
+
+    codeObject->parse();
+
+    funcs.clear();
+    for (auto f: codeObject->funcs())  {
+	funcs.push_back({f->addr(), f, {}});
+    }
+    SortFunctions();
+}
+
+
+// Reuses the records of the functions whose code and callees have not
+// changed since the previous run and parses only the rest.  If every
+// previous function had a symbol, the functions are found from the symbol
+// table and PLT without parsing, and each changed or new function is parsed
+// (along with what it calls).  Otherwise the whole binary is parsed and only
+// the summarization of unchanged functions is skipped.
+void BinaryAnalysis::ParseIncremental(const PreviousState &previous)
+{
+    using namespace std;
+
+    map<Address, vector<string>> knownNames;
+    bool parseAll = !previous.AllHaveSymbols();
+    if (parseAll)  {
+	Parse();
+	for (auto &f: funcs)  {
+	    knownNames[f.entry].push_back(f.func->name());
+	}
+    }  else  {
+	knownNames = SymbolNames(false);
+    }
+
+    vector<OutputFunction> reused;
+    set<Address> reusedEntries;
+    for (auto &known: knownNames)  {
+	auto entry = known.first;
+	if (auto prev = previous.Match(entry, known.second, codeSource, knownNames))  {
+	    reused.push_back({entry, nullptr, MoveState(*prev, entry, RegionContaining(codeSource, entry))});
+	    reusedEntries.insert(entry);
+	}  else if (!parseAll)  {
+	    codeObject->parse(entry, true);
+	}
+    }
+
+    vector<OutputFunction> summarize;
+    if (parseAll)  {
+	summarize.swap(funcs);
+    }  else  {
+	for (auto f: codeObject->funcs())  {
+	    summarize.push_back({f->addr(), f, {}});
+	}
+    }
+
+    funcs.clear();
+    for (auto &f: summarize)  {
+	if (!reusedEntries.count(f.entry))  {
+	    funcs.push_back(f);
+	}
+    }
+    for (auto &f: reused)  {
+	funcs.push_back(move(f));
+    }
+    SortFunctions();
+}
+
+
+// Parses only the selected functions, found in the symbol table and PLT,
+// without following their calls, so the time and memory used grow with the
+// selection instead of the binary; the callees are named from the symbol
+// table and PLT.  A function without a symbol is never selected.  If
+// reachable, the functions are the ones reachable from the selected ones
+// instead, so everything they call is parsed.
+void BinaryAnalysis::ParseSelected(const FunctionSelection &selection, bool reachable)
+{
+    using namespace std;
+
+    bool byName = selection.HasNameSelectors();
+    set<Address> exported;
+    set<Address> selected;
+    symbolNames = SymbolNames(byName, selection.ExportedOnly() ? &exported : nullptr);
+    for (auto &known: symbolNames)  {
+	auto entry = known.first;
+	if (!selection.MatchesLocation(entry, RegionName(RegionContaining(codeSource, entry))))  {
+	    continue;
+	}
+	if (selection.ExportedOnly() && !exported.count(entry))  {
+	    continue;
+	}
+	if (byName && none_of(known.second.begin(), known.second.end(), [&selection](const string &name)  {
+		    return selection.MatchesName(name);
+		}))  {
+	    continue;
+	}
+	selected.insert(entry);
+    }
+
+    for (auto entry: selected)  {
+	codeObject->parse(entry, reachable);
+    }
+
+    vector<Function *> found;
+    for (auto f: codeObject->funcs())  {
+	if (selected.count(f->addr()))  {
+	    found.push_back(f);
+	}
+    }
+    if (reachable)  {
+	found = Reachable(found);
+	symbolNames.clear();
+    }
+
+    funcs.clear();
+    for (auto f: found)  {
+	funcs.push_back({f->addr(), f, {}});
+    }
+    SortFunctions();
+}
+
+
+// Returns the roots and the functions reachable from them by calls and tail
+// calls.  A function only called through a pointer is not reachable.
+std::vector<Dyninst::ParseAPI::Function *> BinaryAnalysis::Reachable(const std::vector<Function *> &roots)
+{
+    using namespace std;
+
+    set<Function *> seen;
+    vector<Function *> reachable;
+    for (auto f: roots)  {
+	if (seen.insert(f).second)  {
+	    reachable.push_back(f);
+	}
+    }
+    vector<Function *> callees;
+    for (size_t i = 0; i < reachable.size(); ++i)  {
+	for (auto b: reachable[i]->blocks())  {
+	    for (auto e: b->targets())  {
+		auto type = e->type();
+		if (e->sinkEdge() || type == ParseAPI::RET || type == ParseAPI::CALL_FT)  {
+		    continue;
+		}
+		if (type != ParseAPI::CALL && !e->interproc())  {
+		    continue;
+		}
+		callees.clear();
+		auto inserter = back_inserter(callees);
+		e->trg()->getFuncs(inserter);
+		for (auto f: callees)  {
+		    if (seen.insert(f).second)  {
+			reachable.push_back(f);
+		    }
+		}
+	    }
+	}
+    }
+
+    return reachable;
+}
+
+
+// Returns the names of the functions in the symbol table and PLT by entry
+// address, found without parsing.  The names are mangled, and also
+// demangled if withPrettyNames.  If exported is not null, the entries with
+// a global or weak symbol visible in the dynamic symbol table are added.
+std::map<Address, std::vector<std::string>> BinaryAnalysis::SymbolNames(bool withPrettyNames,
+	std::set<Address> *exported) const
+{
+    using namespace std;
+
+    map<Address, vector<string>> symbolNames;
+    vector<SymtabAPI::Function *> symtabFuncs;
+    symtab->getAllFunctions(symtabFuncs);
+    for (auto sf: symtabFuncs)  {
+	auto entry = sf->getOffset();
+	if (codeSource->isValidAddress(entry) && RegionContaining(codeSource, entry))  {
+	    auto &names = symbolNames[entry];
+	    for (auto &name: sf->getAllMangledNames())  {
+		names.push_back(name);
+	    }
+	    if (withPrettyNames)  {
+		for (auto &name: sf->getAllPrettyNames())  {
+		    names.push_back(name);
+		}
+	    }
+	    if (exported && IsExported(sf))  {
+		exported->insert(entry);
+	    }
+	}
+    }
+    for (auto &l: codeSource->linkage())  {
+	symbolNames[l.first].push_back(l.second);
+    }
+
+    return symbolNames;
+}
+
+
+// Orders the functions by entry address so the output order does not
+// depend on how the functions were discovered.
+void BinaryAnalysis::SortFunctions()
+{
+    std::stable_sort(funcs.begin(), funcs.end(), [](const OutputFunction &a, const OutputFunction &b)  {
+	return a.entry < b.entry;
+    });
+}
+
+
+size_t BinaryAnalysis::NumBlocks() const
+{
+    size_t numBlocks = 0;
+    for (auto &f: funcs)  {
+	if (f.func)  {
+	    auto blocks = f.func->blocks();
+	    numBlocks += std::distance(blocks.begin(), blocks.end());
+	}
+    }
+
+    return numBlocks;
+}
+
+
+size_t BinaryAnalysis::NumReused() const
+{
+    size_t numReused = 0;
+    for (auto &f: funcs)  {
+	numReused += !f.func;
+    }
+
+    return numReused;
+}
+
+
+// Writes the records of the functions at the indexes into Functions(), in
+// that order, summarizing only those functions.  With --interprocedural
+// the indexes have to be all the functions, as the callee summaries are
+// found from the functions written.
+void BinaryAnalysis::WriteSelectedRecords(const RecordSink &sink, unsigned jobs,
+	const std::vector<size_t> &indexes)
+{
+    std::vector<OutputFunction> written;
+    for (auto i: indexes)  {
+	written.push_back(funcs[i]);
+    }
+    WriteRecords(sink, written, jobs, nullptr);
+}
+
+
+void BinaryAnalysis::WriteRecords(const RecordSink &sink, std::vector<OutputFunction> &written,
+	unsigned jobs, std::ostream *stateOut)
+{
+    RecordSink countedSink = sink;
+    if (runStats.enabled)  {
+	countedSink = [&sink](const FunctionState &f)  {
+	    PhaseTimer timer(&runStats.write);
+	    runStats.callSites += f.record.calls.size();
+	    sink(f);
+	};
+    }
+
+    // calls can go to any function parsed, not just those written
+    if (!calleesBuilt && any_of(written.begin(), written.end(),
+	    [](const OutputFunction &f)  { return f.func; }))  {
+	auto &registers = AbiRegisters::ForAddressWidth(codeSource->getAddressWidth());
+	tables.names = std::make_shared<RecordNames>(registers.Names());
+	tables.callees.Build(codeObject, *tables.names, symbolNames.empty() ? nullptr : &symbolNames);
+	calleesBuilt = true;
+    }
+
+    try  {
+	if (options.interprocedural)  {
+	    WriteInterproceduralFunctions(countedSink, written, jobs, stateOut, &tables);
+	}  else  {
+	    WriteFunctions(countedSink, written, jobs, stateOut, &tables);
+	}
+    }  catch (...)  {
+	tables.blockCache.Clear();
+	throw;
+    }
+    tables.blockCache.Clear();
+}
+
+
+// Writes the functions member.  If object is not null, the calls to the PLT
+// are resolved in its scope.
+void BinaryAnalysis::WriteJsonFunctions(JsonWriter &writer, unsigned jobs,
+	const SharedLibraries::Object *object)
+{
+    writer.AddMemberKey("functions");
+    writer.OpenArray();
+    WriteRecords([&writer, object](const FunctionState &f)  {
+	if (object)  {
+	    auto record = f.record;
+	    ResolvePltCalls(record, *object);
+	    record.WriteJson(writer);
+	}  else  {
+	    f.record.WriteJson(writer);
+	}
+    }, jobs);
+    writer.CloseArray();
+}
+
+
+// Sets the number of threads ParseAPI uses to parse in the calling thread.
+void SetParseThreads(unsigned defaultThreads)
+{
+    auto n = options.parseThreads > 0 ? options.parseThreads : defaultThreads;
+    if (n > 0)  {
+	omp_set_num_threads(n);
+    }
+}
+
+
+// Returns a string identifying the contents of the binary:  its GNU
+// build-id and size (a stripped binary has the same build-id as the
+// unstripped one), or the SHA-256 of its contents if it has no build-id.
+// Returns "" if the binary can not be read.
+std::string BinaryId(const std::string &path)
+{
+    using namespace std;
+
+    string id;
+    ElfFile elf(path);
+    error_code ec;
+    auto size = filesystem::file_size(path, ec);
+    if (ec)  {
+	return "";
+    }
+    if (elf.BuildId(id))  {
+	return "build-id:" + id + " size:" + to_string(size);
+    }  else if (Sha256::HexDigestFile(path, id))  {
+	return "sha256:" + id;
+    }
+
+    return "";
+}
+
+
+// Returns the cache key for the binary's results in the given format, or ""
+// if the binary can not be read.  If object is not null the results depend
+// on the libraries in its scope too, so they are part of the key.
+std::string CacheKey(const std::string &path, bool binary, int outputIndent,
+	const SharedLibraries::Object *object = nullptr)
+{
+    using namespace std;
+
+    auto id = BinaryId(path);
+    if (id.empty())  {
+	return "";
+    }
+    if (object)  {
+	for (size_t i = 1; i < object->scope.size(); ++i)  {
+	    auto libraryId = BinaryId(object->scope[i]->path);
+	    if (libraryId.empty())  {
+		return "";
+	    }
+	    id += '\n' + object->scope[i]->path + ' ' + libraryId;
+	}
+    }
+
+    return Sha256::HexDigest(options.OutputSignature(binary, outputIndent) + '\n' + id);
+}
+
+
+void AnalyzeBinary(std::ostream &out, ResultCache *cache)
+{
+    using namespace std;
+
+    Stopwatch stopwatch;
+
+    // a cached result has no state or index to save
+    string cacheKey;
+    if (cache)  {
+	cacheKey = CacheKey(options.args[0], options.binaryOutput, options.indent);
+	if (!cacheKey.empty() && !options.saveState && !options.indexFile
+		&& cache->Fetch(cacheKey, out))  {
+	    runStats.cacheHit = true;
+	    if (options.timing)  {
+		clog << "cache:     hit " << cacheKey << " " << stopwatch.Seconds() << "s\n";
+	    }
+	    return;
+	}
+    }
+
+    // on a cache miss the output is also written to a new cache entry
+    ofstream cacheFile;
+    string cachePath;
+    if (!cacheKey.empty())  {
+	cachePath = cache->NewTempFile(cacheFile);
+    }
+    TeeStreambuf tee(out.rdbuf(), cacheFile.rdbuf());
+    ostream teeOut(&tee);
+    CountingStreambuf counter(cacheFile.is_open() ? &tee : out.rdbuf());
+    ostream countedOut(&counter);
+    ostream &resultOut = runStats.enabled ? countedOut : cacheFile.is_open() ? teeOut : out;
+
+    double parseSeconds, summarizeSeconds;
+    size_t numFuncs, numBlocks, numReused;
+    uint64_t numIterations, sharedBlockHits, sharedBlockLookups;
+    try  {
+	PreviousState previous;
+	if (options.previousState)  {
+	    previous.Read(options.previousState, options.RecordSignature());
+	}
+	ofstream stateFile;
+	if (options.saveState)  {
+	    stateFile.open(options.saveState);
+	    if (!stateFile)  {
+		throw runtime_error{string{"unable to open state file '"} + options.saveState + "'"};
+	    }
+	    StateFile::WriteHeader(stateFile, options.RecordSignature());
+	}
+
+	// ParseAPI parses in parallel using OpenMP
+	SetParseThreads(0);
+
+	BinaryAnalysis analysis(options.args[0]);
+	{
+	    PhaseTimer timer(runStats.Phase(runStats.parse), true);
+	    if (options.previousState)  {
+		analysis.ParseIncremental(previous);
+	    }  else  {
+		analysis.Parse();
+	    }
+	}
+	parseSeconds = stopwatch.Seconds();
+	numFuncs = analysis.Functions().size();
+	numBlocks = options.timing || runStats.enabled ? analysis.NumBlocks() : 0;
+	numReused = analysis.NumReused();
+
+	// the parsed binary has to stay in memory until all are summarized
+	auto rss = MemoryUsage::CurrentRss();
+	if (options.maxMemory && rss > options.maxMemory)  {
+	    clog << "warning: the parsed binary uses " << (rss >> 20)
+		    << " MiB, more than --max-memory\n";
+	}
+
+	stopwatch.Restart();
+	PhaseTimer summarizeTimer(runStats.Phase(runStats.summarize), true);
+	auto startIterations = FunctionSummary::PropagationIterations();
+	auto stateOut = options.saveState ? &stateFile : nullptr;
+	CallIndexWriter index;
+	if (options.binaryOutput)  {
+	    RecordFileWriter records(resultOut, options.RecordSignature());
+	    analysis.WriteRecords([&](const FunctionState &f)  {
+		records.Write(f.record);
+		if (options.indexFile)  {
+		    index.Add(f.record, f.entry);
+		}
+	    }, options.jobs, stateOut);
+	    records.End();
+	}  else  {
+	    JsonWriter writer(resultOut, options.indent);
+	    writer.OpenObject();
+	    writer.AddMemberKey("functions");
+	    writer.OpenArray();
+	    analysis.WriteRecords([&](const FunctionState &f)  {
+		f.record.WriteJson(writer);
+		if (options.indexFile)  {
+		    index.Add(f.record, f.entry);
+		}
+	    }, options.jobs, stateOut);
+	    writer.CloseArray();
+	    writer.CloseObject();
+	    writer.End();
+	}
+	if (options.indexFile)  {
+	    index.Write(options.indexFile);
+	}
+	summarizeSeconds = stopwatch.Seconds();
+	numIterations = FunctionSummary::PropagationIterations() - startIterations;
+	runStats.functions = numFuncs;
+	runStats.functionsReused = numReused;
+	runStats.blocks = numBlocks;
+	runStats.dataflowIterations = numIterations;
+	runStats.bytesWritten = counter.Count();
+	sharedBlockHits = runStats.sharedBlockHits = analysis.SharedBlocks().Hits();
+	runStats.sharedBlockMisses = analysis.SharedBlocks().Misses();
+	sharedBlockLookups = sharedBlockHits + runStats.sharedBlockMisses;
+
+	if (options.saveState && !stateFile.flush())  {
+	    throw runtime_error{string{"error writing state file '"} + options.saveState + "'"};
+	}
+    }  catch (...)  {
+	if (!cachePath.empty())  {
+	    cache->Discard(cachePath);
+	}
+	throw;
+    }
+
+    if (!cachePath.empty())  {
+	cacheFile.close();
+	if (resultOut && cacheFile && !tee.SecondFailed())  {
+	    cache->Commit(cachePath, cacheKey);
+	}  else  {
+	    cache->Discard(cachePath);
+	}
+    }
+
+    if (options.timing)  {
+	clog << "parse:     " << parseSeconds << "s using "
+		<< (options.parseThreads > 0 ? options.parseThreads : omp_get_max_threads())
+		<< " threads (" << numFuncs << " functions, "
+		<< numBlocks << " blocks, " << numReused << " functions reused)\n"
+	    << "summarize: " << summarizeSeconds << "s using " << options.jobs << " threads ("
+		<< numIterations << " dataflow iterations, " << sharedBlockHits << " of "
+		<< sharedBlockLookups << " shared blocks reused)\n";
+    }
+}
+
+
+bool IsElfFile(const std::string &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    char magic[4];
+    return f.read(magic, sizeof magic) && !memcmp(magic, "\177ELF", sizeof magic);
+}
+
+
+// Returns the binaries to analyze in batch mode:  the lines of the list file
+// (stdin if "-"), or the ELF files found recursively in the directory.  With
+// --dependencies and no batch, it is the binary given.
+std::vector<std::string> BatchPaths()
+{
+    using namespace std;
+    namespace fs = std::filesystem;
+
+    vector<string> paths;
+
+    if (!options.batchList && !options.batchDir)  {
+	paths.push_back(options.args[0]);
+    }
+
+    if (options.batchList)  {
+	ifstream listFile;
+	istream *in = &cin;
+	if (strcmp(options.batchList, "-"))  {
+	    listFile.open(options.batchList);
+	    if (!listFile)  {
+		options.Error(string{"Error opening batch list file '"} + options.batchList + "'\n");
+	    }
+	    in = &listFile;
+	}
+	string line;
+	while (getline(*in, line))  {
+	    if (!line.empty())  {
+		paths.push_back(line);
+	    }
+	}
+    }
+
+    if (options.batchDir)  {
+	error_code ec;
+	auto dirOptions = fs::directory_options::skip_permission_denied;
+	fs::recursive_directory_iterator i(options.batchDir, dirOptions, ec), end;
+	if (ec)  {
+	    options.Error(string{"Error reading batch directory '"} + options.batchDir + "': " + ec.message() + '\n');
+	}
+	vector<string> found;
+	for (; i != end; i.increment(ec))  {
+	    if (ec)  {
+		break;
+	    }
+	    if (i->is_regular_file(ec) && IsElfFile(i->path()))  {
+		found.push_back(i->path());
+	    }
+	}
+	sort(found.begin(), found.end());
+	paths.insert(paths.end(), found.begin(), found.end());
+    }
+
+    return paths;
+}
+
+
+// Returns the batch record for path:  a JSON object with a path member
+// followed by the members of doc, a compact JSON object.  If object is not
+// null, the libraries in its scope and those not found are added after the
+// path.
+std::string BatchRecord(const std::string &path, const std::string &doc,
+	const SharedLibraries::Object *object = nullptr)
+{
+    std::ostringstream record;
+    JsonWriter writer(record, 0);
+    writer.OpenObject();
+    writer.AddMemberKey("path");
+    writer.AddScalar(path);
+    if (object)  {
+	writer.AddMemberKey("libraries");
+	writer.OpenArray();
+	for (size_t i = 1; i < object->scope.size(); ++i)  {
+	    writer.AddScalar(object->scope[i]->path);
+	}
+	writer.CloseArray();
+	writer.AddMemberKey("missingLibraries");
+	writer.OpenArray();
+	for (auto o: object->scope)  {
+	    for (auto &name: o->missing)  {
+		writer.AddScalar(name);
+	    }
+	}
+	writer.CloseArray();
+    }
+    writer.Flush();
+
+    // the object is completed by the members of doc
+    if (doc.size() > 2)  {
+	record << ',';
+    }
+    record.write(doc.data() + 1, doc.size() - 1);
+
+    return record.str();
+}
+
+
+// Returns a compact JSON object with an error member.
+std::string ErrorDoc(const std::string &msg)
+{
+    std::ostringstream error;
+    JsonWriter writer(error, 0);
+    writer.OpenObject();
+    writer.AddMemberKey("error");
+    writer.AddScalar(msg);
+    writer.CloseObject();
+    writer.End();
+
+    return error.str();
+}
+
+
+// Returns the compact JSON object with the functions of the binary at path,
+// from the cache if possible.  If object is not null, the calls to the PLT
+// are resolved in its scope.
+std::string BatchFunctions(const std::string &path, ResultCache *cache,
+	const SharedLibraries::Object *object = nullptr)
+{
+    using namespace std;
+
+    string doc;
+    string cacheKey;
+    if (cache)  {
+	cacheKey = CacheKey(path, false, 0, object);
+	if (!cacheKey.empty() && cache->Fetch(cacheKey, doc))  {
+	    return doc;
+	}
+    }
+
+    BinaryAnalysis analysis(path);
+    analysis.Parse();
+    ostringstream out;
+    JsonWriter writer(out, 0);
+    writer.OpenObject();
+    analysis.WriteJsonFunctions(writer, 1, object);
+    writer.CloseObject();
+    writer.End();
+    doc = out.str();
+
+    if (!cacheKey.empty())  {
+	cache->Store(cacheKey, doc);
+    }
+
+    return doc;
+}
+
+
+// Limits the binaries analyzed at once by a batch while the process uses
+// more than options.maxMemory:  a new binary is only started when under the
+// limit or when no other binary is being analyzed, so the batch uses fewer
+// workers instead of more memory.
+class MemoryGate
+{
+    public:
+	void Enter();
+	void Leave();
+    private:
+	std::mutex		mutex;
+	std::condition_variable	cond;
+	unsigned		active = 0;
+};
+
+
+void MemoryGate::Enter()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (options.maxMemory && active > 0 && MemoryUsage::CurrentRss() > options.maxMemory)  {
+	// memory is also freed by the parse threads, so check periodically
+	cond.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    ++active;
+}
+
+
+void MemoryGate::Leave()
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	--active;
+    }
+    if (options.maxMemory)  {
+	MemoryUsage::ReleaseFreeMemory();
+    }
+    cond.notify_all();
+}
+
+
+// Analyzes many binaries, options.jobs at a time, writing one compact JSON
+// record per line ("JSON Lines") as each binary completes.  A binary that
+// can not be analyzed produces a record with an "error" member instead of
+// "functions" and does not stop the batch.  With --dependencies the shared
+// libraries the binaries need are found first, and each is analyzed once
+// after the binaries, in parallel with them.
+void AnalyzeBatch(std::ostream &out, ResultCache *cache)
+{
+    using namespace std;
+
+    Stopwatch stopwatch;
+
+    auto paths = BatchPaths();
+    vector<const SharedLibraries::Object *> objects;
+    unique_ptr<SharedLibraries> libraries;
+    if (options.dependencies)  {
+	libraries.reset(new SharedLibraries(options.sysroot, options.libraryPath));
+	set<const SharedLibraries::Object *> roots;
+	for (auto &path: paths)  {
+	    objects.push_back(libraries->Add(path));
+	    roots.insert(objects.back());
+	}
+	for (auto library: libraries->Libraries())  {
+	    if (!roots.count(library))  {
+		paths.push_back(library->path);
+		objects.push_back(library);
+	    }
+	}
+    }  else  {
+	objects.resize(paths.size());
+    }
+    mutex outMutex;
+    size_t numFailed = 0;
+
+    // each worker holds one CodeObject, so --jobs bounds the memory used
+    MemoryGate gate;
+    WorkStealingPool pool(options.jobs);
+    pool.Start(paths.size(), [&](size_t i)  {
+	// the workers already use all the threads
+	SetParseThreads(1);
+
+	auto &path = paths[i];
+	string record;
+	bool failed = false;
+	gate.Enter();
+	try  {
+	    record = BatchRecord(path, BatchFunctions(path, cache, objects[i]), objects[i]);
+	}  catch (exception &e)  {
+	    failed = true;
+	    record = BatchRecord(path, ErrorDoc(e.what()), objects[i]);
+	}
+	gate.Leave();
+
+	lock_guard<mutex> lock(outMutex);
+	out << record << '\n' << flush;
+	numFailed += failed;
+    });
+    pool.Wait();
+
+    if (options.timing)  {
+	clog << "batch:     " << stopwatch.Seconds() << "s using " << options.jobs
+	    << " threads (" << paths.size() << " binaries, " << numFailed << " failed)\n";
+    }
+}
+
+
+// The binaries kept parsed by --serve, with the records of the functions
+// summarized so far.  A binary is identified by its canonical path, and is
+// parsed again when its device, inode, size or modification time changes.
+// The memory a binary uses is estimated from the size of its file and the
+// number of its functions and blocks, plus the records kept, and the least
+// recently used binaries are dropped when the total is over maxBytes.  The
+// estimate does not depend on what else the process is doing, which the
+// resident set size does while other clients are answered.  Binaries are
+// parsed and summarized one at a time (using options.jobs threads), while
+// requests answered from what is already summarized are answered
+// concurrently.
+class WarmBinaries
+{
+    public:
+	WarmBinaries(uint64_t maxBytes)
+	    : maxBytes(maxBytes)
+	    {}
+	std::string Analyze(const std::string &path);
+	std::string Function(const std::string &path, const std::string &function);
+	std::string Status();
+    private:
+	struct Binary
+	{
+	    std::string				path;
+	    std::string				fileId;
+	    std::unique_ptr<BinaryAnalysis>	analysis;
+	    uint64_t				bytes = 0;
+	    std::mutex				mutex;		// records, summarized
+	    std::vector<FunctionRecord>		records;
+	    std::vector<bool>			summarized;
+	};
+	using BinaryPtr = std::shared_ptr<Binary>;
+
+	BinaryPtr	Get(const std::string &path);
+	BinaryPtr	Find(const std::string &path, const std::string &fileId);
+	void		Summarize(Binary &binary, const std::vector<size_t> &indexes);
+	std::string	Records(Binary &binary, const std::vector<size_t> &indexes);
+	void		AddBytes(Binary &binary, uint64_t bytes);
+	static uint64_t	ParsedBytes(const std::string &path, const BinaryAnalysis &analysis);
+	static uint64_t	RecordBytes(const FunctionRecord &record);
+	static std::string	FileId(const std::string &path);
+
+	// rough average memory Dyninst keeps for a parsed function and block,
+	// with its edges and decoded instructions
+	static const uint64_t			functionBytes = 2048;
+	static const uint64_t			blockBytes = 1024;
+
+	uint64_t				maxBytes;
+	std::mutex				mutex;		// below
+	std::list<BinaryPtr>			binaries;	// most recent first
+	uint64_t				totalBytes = 0;
+	uint64_t				hits = 0;
+	uint64_t				misses = 0;
+	std::mutex				analysisMutex;
+};
+
+
+// Returns the batch record for the binary at path with all its functions.
+std::string WarmBinaries::Analyze(const std::string &path)
+{
+    auto binary = Get(path);
+    std::vector<size_t> indexes(binary->records.size());
+    for (size_t i = 0; i < indexes.size(); ++i)  {
+	indexes[i] = i;
+    }
+    Summarize(*binary, indexes);
+
+    return BatchRecord(path, Records(*binary, indexes));
+}
+
+
+// Returns the batch record for the binary at path with the functions named
+// function, or with the entry address function (decimal, or hex with a 0x
+// prefix).
+std::string WarmBinaries::Function(const std::string &path, const std::string &function)
+{
+    char *end;
+    uint64_t addr = strtoull(function.c_str(), &end, 0);
+    bool isAddr = !function.empty() && *end == '\0';
+
+    auto binary = Get(path);
+    std::vector<size_t> indexes;
+    auto &funcs = binary->analysis->Functions();
+    for (size_t i = 0; i < funcs.size(); ++i)  {
+	if (isAddr ? funcs[i].entry == addr : funcs[i].func->name() == function)  {
+	    indexes.push_back(i);
+	}
+    }
+    Summarize(*binary, indexes);
+
+    return BatchRecord(path, Records(*binary, indexes));
+}
+
+
+std::string WarmBinaries::Status()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream status;
+    JsonWriter writer(status, 0);
+    writer.OpenObject();
+    writer.AddMemberKey("binaries");
+    writer.AddScalar(binaries.size());
+    writer.AddMemberKey("bytes");
+    writer.AddScalar(totalBytes);
+    writer.AddMemberKey("maxBytes");
+    writer.AddScalar(maxBytes);
+    writer.AddMemberKey("hits");
+    writer.AddScalar(hits);
+    writer.AddMemberKey("misses");
+    writer.AddScalar(misses);
+    writer.CloseObject();
+    writer.End();
+
+    return status.str();
+}
+
+
+// Returns the binary at path, parsing it if it is not kept or has changed.
+WarmBinaries::BinaryPtr WarmBinaries::Get(const std::string &path)
+{
+    using namespace std;
+
+    std::error_code ec;
+    auto canonical = filesystem::canonical(path, ec).string();
+    auto fileId = FileId(canonical);
+    if (ec || fileId.empty())  {
+	throw runtime_error{"unable to open object file '" + path + "'"};
+    }
+    if (auto binary = Find(canonical, fileId))  {
+	return binary;
+    }
+
+    // another client may have parsed it while waiting
+    lock_guard<std::mutex> analysisLock(analysisMutex);
+    if (auto binary = Find(canonical, fileId))  {
+	return binary;
+    }
+
+    auto binary = make_shared<Binary>();
+    binary->path = canonical;
+    binary->fileId = fileId;
+    binary->analysis.reset(new BinaryAnalysis(canonical));
+    SetParseThreads(0);
+    binary->analysis->Parse();
+    binary->records.resize(binary->analysis->Functions().size());
+    binary->summarized.resize(binary->records.size());
+    {
+	lock_guard<std::mutex> lock(mutex);
+	++misses;
+	binaries.push_front(binary);
+    }
+    AddBytes(*binary, ParsedBytes(canonical, *binary->analysis)
+	    + binary->records.size() * sizeof(FunctionRecord));
+
+    return binary;
+}
+
+
+// Returns the binary kept for the canonical path, making it the most
+// recently used, or nullptr if it is not kept.  A binary whose file has
+// changed is dropped.
+WarmBinaries::BinaryPtr WarmBinaries::Find(const std::string &path, const std::string &fileId)
+{
+    BinaryPtr found;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto i = binaries.begin(); i != binaries.end(); ++i)  {
+	if ((*i)->path != path)  {
+	    continue;
+	}
+	if ((*i)->fileId == fileId)  {
+	    found = *i;
+	    binaries.splice(binaries.begin(), binaries, i);
+	    ++hits;
+	}  else  {
+	    totalBytes -= (*i)->bytes;
+	    binaries.erase(i);
+	}
+	break;
+    }
+
+    return found;
+}
+
+
+// Summarizes the functions at the indexes that are not summarized yet.  With
+// --interprocedural all the functions are summarized the first time.
+void WarmBinaries::Summarize(Binary &binary, const std::vector<size_t> &indexes)
+{
+    using namespace std;
+
+    auto missing = [&]  {
+	lock_guard<std::mutex> lock(binary.mutex);
+	vector<size_t> notSummarized;
+	for (auto i: indexes)  {
+	    if (!binary.summarized[i])  {
+		notSummarized.push_back(i);
+	    }
+	}
+	if (options.interprocedural && !notSummarized.empty())  {
+	    notSummarized.resize(binary.records.size());
+	    for (size_t i = 0; i < notSummarized.size(); ++i)  {
+		notSummarized[i] = i;
+	    }
+	}
+	return notSummarized;
+    };
+
+    if (missing().empty())  {
+	return;
+    }
+    lock_guard<std::mutex> analysisLock(analysisMutex);
+    auto summarize = missing();
+    if (summarize.empty())  {
+	return;
+    }
+
+    vector<FunctionRecord> records;
+    binary.analysis->WriteSelectedRecords([&records](const FunctionState &f)  {
+	records.push_back(f.record);
+    }, options.jobs, summarize);
+    uint64_t bytes = 0;
+    {
+	lock_guard<std::mutex> lock(binary.mutex);
+	for (size_t i = 0; i < summarize.size(); ++i)  {
+	    bytes += RecordBytes(records[i]);
+	    binary.records[summarize[i]] = move(records[i]);
+	    binary.summarized[summarize[i]] = true;
+	}
+    }
+    AddBytes(binary, bytes);
+}
+
+
+// Returns a compact JSON object with the functions at the indexes, which
+// have to be summarized.
+std::string WarmBinaries::Records(Binary &binary, const std::vector<size_t> &indexes)
+{
+    std::lock_guard<std::mutex> lock(binary.mutex);
+    std::ostringstream out;
+    JsonWriter writer(out, 0);
+    writer.OpenObject();
+    writer.AddMemberKey("functions");
+    writer.OpenArray();
+    for (auto i: indexes)  {
+	binary.records[i].WriteJson(writer);
+    }
+    writer.CloseArray();
+    writer.CloseObject();
+    writer.End();
+
+    return out.str();
+}
+
+
+// Adds to the memory used by the binary, then drops the least recently used
+// binaries, other than the most recent, while over maxBytes.
+void WarmBinaries::AddBytes(Binary &binary, uint64_t bytes)
+{
+    using namespace std;
+
+    vector<BinaryPtr> dropped;
+    {
+	lock_guard<std::mutex> lock(mutex);
+	binary.bytes += bytes;
+	if (find_if(binaries.begin(), binaries.end(),
+		[&binary](const BinaryPtr &b)  { return b.get() == &binary; }) != binaries.end())  {
+	    totalBytes += bytes;
+	}
+	while (totalBytes > maxBytes && binaries.size() > 1)  {
+	    totalBytes -= binaries.back()->bytes;
+	    dropped.push_back(move(binaries.back()));
+	    binaries.pop_back();
+	}
+    }
+
+    // a binary still used by a request is freed when the request is done
+    if (!dropped.empty())  {
+	dropped.clear();
+	MemoryUsage::ReleaseFreeMemory();
+    }
+}
+
+
+// Returns the estimated memory used by the parsed binary at path:  its file,
+// which bounds the code and symbol tables read from it, and its functions
+// and blocks.
+uint64_t WarmBinaries::ParsedBytes(const std::string &path, const BinaryAnalysis &analysis)
+{
+    std::error_code ec;
+    uint64_t fileBytes = std::filesystem::file_size(path, ec);
+    if (ec)  {
+	fileBytes = 0;
+    }
+
+    return fileBytes + analysis.Functions().size() * functionBytes
+	    + analysis.NumBlocks() * blockBytes;
+}
+
+
+// Returns the memory the record owns, other than the record itself and the
+// names shared by the binary's records.
+uint64_t WarmBinaries::RecordBytes(const FunctionRecord &record)
+{
+    uint64_t bytes = record.name.capacity() + record.section.capacity()
+	    + record.calls.capacity() * sizeof(CallRecord);
+    for (auto &call: record.calls)  {
+	bytes += call.funcNames.capacity() * sizeof(RecordNames::Id) + call.library.capacity();
+    }
+
+    return bytes;
+}
+
+
+// Returns a string that changes when the file at path is replaced or
+// modified, or "" if it can not be found.
+std::string WarmBinaries::FileId(const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st))  {
+	return "";
+    }
+
+    return std::to_string(st.st_dev) + ' ' + std::to_string(st.st_ino) + ' '
+	    + std::to_string(st.st_size) + ' ' + std::to_string(st.st_mtim.tv_sec) + '.'
+	    + std::to_string(st.st_mtim.tv_nsec);
+}
+
+
+// The clients of --serve being answered, by their connection's file
+// descriptor.  Stop stops reading requests:  each client is answered the
+// request it sent last, then its connection is ended.
+class ServeClients
+{
+    public:
+	ServeClients(size_t maxClients)
+	    : maxClients(maxClients)
+	    {}
+	bool WaitForRoom();
+	void Add(int fd);
+	void Remove(int fd);
+	void Stop();
+	void WaitForAll();
+    private:
+	size_t					maxClients;
+	std::mutex				mutex;		// below
+	std::condition_variable			changed;
+	std::set<int>				fds;
+	bool					stopping = false;
+};
+
+
+// Waits until fewer than maxClients clients are answered.  Returns false if
+// stopping.
+bool ServeClients::WaitForRoom()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]  {
+	return stopping || fds.size() < maxClients;
+    });
+
+    return !stopping;
+}
+
+
+void ServeClients::Add(int fd)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fds.insert(fd);
+    if (stopping)  {
+	shutdown(fd, SHUT_RD);
+    }
+}
+
+
+// Removes the client, which has to be done before its connection is closed:
+// Stop could shut down another file reusing the descriptor.
+void ServeClients::Remove(int fd)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fds.erase(fd);
+    changed.notify_all();
+}
+
+
+void ServeClients::Stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    for (auto fd: fds)  {
+	shutdown(fd, SHUT_RD);
+    }
+    changed.notify_all();
+}
+
+
+void ServeClients::WaitForAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]  {
+	return fds.empty();
+    });
+}
+
+
+// Answers the requests of a client of --serve, a line each, until it
+// disconnects.  Fields are separated by tabs, escaped as in the state file:
+//
+//	analyze <path>
+//	function <path> <name or entry address>
+//	status
+//
+// Each answer is a line of compact JSON:  a batch record for analyze and
+// function, or for status the binaries kept and the memory they use.
+void ServeClient(WarmBinaries &binaries, SocketConnection &conn)
+{
+    using namespace std;
+
+    string line;
+    while (conn.ReadLine(line))  {
+	auto f = StateFile::SplitLine(line);
+	string answer;
+	try  {
+	    if (f[0] == "analyze" && f.size() == 2)  {
+		answer = binaries.Analyze(f[1]);
+	    }  else if (f[0] == "function" && f.size() == 3)  {
+		answer = binaries.Function(f[1], f[2]);
+	    }  else if (f[0] == "status" && f.size() == 1)  {
+		answer = binaries.Status();
+	    }  else  {
+		answer = ErrorDoc("unknown request '" + line + "'");
+	    }
+	}  catch (exception &e)  {
+	    answer = f.size() > 1 ? BatchRecord(f[1], ErrorDoc(e.what())) : ErrorDoc(e.what());
+	}
+	if (!conn.Write(answer + '\n'))  {
+	    break;
+	}
+    }
+}
+
+
+// Runs the --serve daemon:  answers the requests of each client connecting
+// to the socket on a thread of its own, at most --serve-clients at a time,
+// until SIGTERM or SIGINT.  Then it stops accepting clients, waits for the
+// requests being answered, and removes the socket.
+void Serve()
+{
+    WarmBinaries binaries(options.serveMemory);
+    UnixSocketServer server(options.serveSocket);
+    ServeClients clients(options.serveClients);
+    if (options.timing)  {
+	std::clog << "serve:     listening on " << options.serveSocket << '\n';
+    }
+
+    // the signals are blocked in every thread, threads started later inherit
+    // that, and taken by a thread of their own, which can use the mutexes
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::thread signalThread([&signals, &server, &clients]  {
+	int sig;
+	sigwait(&signals, &sig);
+	clients.Stop();
+	server.Stop();
+    });
+
+    try  {
+	while (clients.WaitForRoom())  {
+	    auto fd = server.Accept();
+	    if (fd < 0)  {
+		break;
+	    }
+	    clients.Add(fd);
+	    try  {
+		std::thread([&binaries, &clients, fd]  {
+		    SocketConnection conn(fd);
+		    ServeClient(binaries, conn);
+		    clients.Remove(fd);
+		}).detach();
+	    }  catch (...)  {
+		clients.Remove(fd);
+		close(fd);
+		throw;
+	    }
+	}
+    }  catch (...)  {
+	// wake the signal thread, which stops the clients
+	pthread_kill(signalThread.native_handle(), SIGTERM);
+	signalThread.join();
+	clients.WaitForAll();
+	throw;
+    }
+    signalThread.join();
+    clients.WaitForAll();
+    if (options.timing)  {
+	std::clog << "serve:     stopped\n";
+    }
+}
+
+
+// Writes a call site found by a query as a line of compact JSON.
+void WriteQueryCall(std::ostream &out, const CallIndex &index, uint32_t callId)
+{
+    auto &call = index.Call(callId);
+    auto &func = index.Function(call.function);
+
+    JsonWriter writer(out, 0);
+    writer.OpenObject();
+    writer.AddMemberKey("funcName");
+    writer.AddScalar(index.String(func.name));
+    WriteJsonAddressMember(writer, "funcEntry", func.entry);
+    WriteJsonAddressMember(writer, "callInstructionAddr", call.callInsnAddr);
+    WriteJsonAddressMember(writer, "calledAddr", call.calledAddr);
+    writer.AddMemberKey("callToPlt");
+    writer.AddScalar(bool(call.isToPlt));
+    writer.AddMemberKey("liveRegisters");
+    writer.OpenArray();
+    std::string_view regs = index.String(call.liveRegs);
+    while (!regs.empty())  {
+	auto end = std::min(regs.find(','), regs.size());
+	writer.AddScalar(regs.substr(0, end));
+	regs.remove_prefix(std::min(end + 1, regs.size()));
+    }
+    writer.CloseArray();
+    writer.AddMemberKey("funcNames");
+    writer.OpenArray();
+    for (uint32_t i = 0; i < call.numNames; ++i)  {
+	writer.AddScalar(index.String(index.CallNames(call)[i]));
+    }
+    writer.CloseArray();
+    writer.CloseObject();
+    writer.Flush();
+    out << '\n';
+}
+
+
+// Returns true if reg is in the comma separated list regs.
+bool HasRegister(std::string_view regs, std::string_view reg)
+{
+    while (!regs.empty())  {
+	auto end = std::min(regs.find(','), regs.size());
+	if (regs.substr(0, end) == reg)  {
+	    return true;
+	}
+	regs.remove_prefix(std::min(end + 1, regs.size()));
+    }
+
+    return false;
+}
+
+
+// Answers a query from an index written by --index, writing each result as
+// a line of compact JSON.  Returns the exit status.
+int Query(const char *programName, int argc, char **argv)
+{
+    using namespace std;
+
+    auto usage = [programName]()  {
+	clog << "Usage: " << programName << " query INDEX callee NAME [REGISTER]\n"
+	    << "       " << programName << " query INDEX caller NAME\n"
+	    << "       " << programName << " query INDEX range START END\n"
+	    << "       " << programName << " query INDEX function ADDR\n"
+	    << "  callee    call sites that may call NAME (with REGISTER live)\n"
+	    << "  caller    call sites in the functions named NAME\n"
+	    << "  range     call sites with a call instruction in [START, END)\n"
+	    << "  function  the function with the closest entry at or below ADDR\n"
+	    << "Addresses are decimal, or hexadecimal with a 0x prefix.\n";
+	return 1;
+    };
+    auto address = [](const char *s)  {
+	char *end;
+	errno = 0;
+	auto a = strtoull(s, &end, 0);
+	if (errno || end == s || *end != '\0')  {
+	    throw runtime_error{string{"invalid address '"} + s + "'"};
+	}
+	return uint64_t(a);
+    };
+
+    if (argc < 3)  {
+	return usage();
+    }
+    string command = argv[1];
+
+    try  {
+	CallIndex index(argv[0]);
+	vector<uint32_t> calls;
+	if (command == "callee" && (argc == 3 || argc == 4))  {
+	    for (auto c: index.CallsTo(argv[2]))  {
+		if (argc == 3 || HasRegister(index.String(index.Call(c).liveRegs), argv[3]))  {
+		    calls.push_back(c);
+		}
+	    }
+	}  else if (command == "caller" && argc == 3)  {
+	    calls = index.CallsFrom(argv[2]);
+	}  else if (command == "range" && argc == 4)  {
+	    calls = index.CallsInRange(address(argv[2]), address(argv[3]));
+	}  else if (command == "function" && argc == 3)  {
+	    auto f = index.FunctionAt(address(argv[2]));
+	    if (!f)  {
+		return 1;
+	    }
+	    JsonWriter writer(cout, 0);
+	    writer.OpenObject();
+	    writer.AddMemberKey("funcName");
+	    writer.AddScalar(index.String(f->name));
+	    WriteJsonAddressMember(writer, "funcEntry", f->entry);
+	    WriteJsonAddressMember(writer, "funcAddr", f->addr);
+	    writer.AddMemberKey("sectionName");
+	    writer.AddScalar(index.String(f->section));
+	    writer.AddMemberKey("isInPlt");
+	    writer.AddScalar(bool(f->isInPlt));
+	    writer.AddMemberKey("numCalls");
+	    writer.AddScalar(f->numCalls);
+	    writer.CloseObject();
+	    writer.Flush();
+	    cout << '\n';
+	    return 0;
+	}  else  {
+	    return usage();
+	}
+
+	for (auto c: calls)  {
+	    WriteQueryCall(cout, index, c);
+	}
+	cout << flush;
+    }  catch (exception &e)  {
+	clog << programName << ": " << e.what() << '\n';
+	return 1;
+    }
+
+    return 0;
+}
+
+
+void RunStatistics::WriteJson(std::ostream &out) const
+{
+    JsonWriter writer(out, 2);
+    writer.OpenObject();
+    writer.AddMemberKey("binary");
+    writer.AddScalar(options.args.empty() ? "" : options.args[0]);
+    writer.AddMemberKey("version");
+    writer.AddScalar(options.programVersion);
+    writer.AddMemberKey("cacheHit");
+    writer.AddScalar(cacheHit);
+
+    writer.AddMemberKey("threads");
+    writer.OpenObject();
+    writer.AddMemberKey("parse");
+    writer.AddScalar(options.parseThreads > 0 ? int(options.parseThreads) : omp_get_max_threads());
+    writer.AddMemberKey("summarize");
+    writer.AddScalar(options.jobs);
+    writer.CloseObject();
+
+    writer.AddMemberKey("phases");
+    writer.OpenObject();
+    std::pair<const char *, const PhaseTime *> phases[] = {
+	{"total", &total},
+	{"symtabLoad", &symtabLoad},
+	{"parse", &parse},
+	{"summarize", &summarize},
+	{"summarizeBlocks", &summarizeBlocks},
+	{"addParamRegs", &addParamRegs},
+	{"propagateStartRegs", &propagateStartRegs},
+	{"write", &write},
+    };
+    for (auto &p: phases)  {
+	writer.AddMemberKey(p.first);
+	writer.OpenObject();
+	writer.AddMemberKey("wallSeconds");
+	writer.AddScalar(p.second->WallSeconds());
+	writer.AddMemberKey("cpuSeconds");
+	writer.AddScalar(p.second->CpuSeconds());
+	writer.AddMemberKey("count");
+	writer.AddScalar(p.second->Count());
+	writer.CloseObject();
+    }
+    writer.CloseObject();
+
+    writer.AddMemberKey("counters");
+    writer.OpenObject();
+    std::pair<const char *, uint64_t> counters[] = {
+	{"functions", functions},
+	{"functionsReused", functionsReused},
+	{"blocks", blocks},
+	{"instructions", instructions},
+	{"sharedBlockHits", sharedBlockHits},
+	{"sharedBlockMisses", sharedBlockMisses},
+	{"dataflowIterations", dataflowIterations},
+	{"callSites", callSites},
+	{"bytesWritten", bytesWritten},
+	{"peakRssBytes", MemoryUsage::PeakRss()},
+    };
+    for (auto &c: counters)  {
+	writer.AddMemberKey(c.first);
+	writer.AddScalar(c.second);
+    }
+    writer.CloseObject();
+
+    writer.AddMemberKey("slowestFunctions");
+    writer.OpenArray();
+    for (auto &f: slowest.Sorted())  {
+	writer.OpenObject();
+	writer.AddMemberKey("name");
+	writer.AddScalar(f.name);
+	WriteJsonAddressMember(writer, "entry", f.entry);
+	writer.AddMemberKey("seconds");
+	writer.AddScalar(f.seconds);
+	writer.AddMemberKey("blocks");
+	writer.AddScalar(f.numBlocks);
+	writer.CloseObject();
+    }
+    writer.CloseArray();
+
+    writer.CloseObject();
+    writer.End();
+}
+
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+
+    if (argc > 1 && !strcmp(argv[1], "query"))  {
+	return Query(argv[0], argc - 2, argv + 2);
+    }
+
+    options.ProcessOptions(argc, argv);
+
+    if (argc < 2)  {
+	return 1;
+    }
+
+    if (options.serveSocket)  {
+	try  {
+	    Serve();
+	}  catch (exception &e)  {
+	    options.Error(string{e.what()} + '\n');
+	}
+	return 0;
+    }
+
+    const char *outputPath = nullptr;
+    if (options.batchList || options.batchDir)  {
+	if (options.args.size() > 0)  {
+	    outputPath = options.args[0];
+	}
+    }  else if (options.args.size() > 1)  {
+	outputPath = options.args[1];
+    }
+
+    if (!options.compressionGiven && outputPath)  {
+	options.compression = CompressingStreambuf::CodecForPath(outputPath);
+	options.compressionLevel = CompressingStreambuf::DefaultLevel(options.compression);
+    }
+    if (!CompressingStreambuf::IsAvailable(options.compression))  {
+	options.Error("zstd compression is not available (libzstd was not found when built)\n");
+    }
+    bool binaryFile = options.binaryOutput || options.compression != CompressingStreambuf::none;
+
+    std::ostream *jsonFile = &cout;
+    std::ofstream outputFile;
+    if (outputPath)  {
+	outputFile.open(outputPath, binaryFile ? ios::out | ios::binary : ios::out);
+	if (!outputFile)  {
+	    options.Error(string{"Error opening output file '"} + outputPath + "'\n");
+	}
+	jsonFile = &outputFile;
+    }
+
+    // compressed on a thread of its own while the analysis runs
+    unique_ptr<CompressingStreambuf> compressor;
+    ostream compressedFile(nullptr);
+    if (options.compression != CompressingStreambuf::none)  {
+	compressor.reset(new CompressingStreambuf(jsonFile->rdbuf(), options.compression,
+		options.compressionLevel));
+	compressedFile.rdbuf(compressor.get());
+	jsonFile = &compressedFile;
+    }
+
+    runStats.enabled = options.stats;
+    try  {
+	PhaseTimer timer(runStats.Phase(runStats.total), true);
+	unique_ptr<ResultCache> cache;
+	if (options.cacheDir)  {
+	    cache.reset(new ResultCache(options.cacheDir, options.cacheMaxSize));
+	}
+
+	if (options.batchList || options.batchDir || options.dependencies)  {
+	    AnalyzeBatch(*jsonFile, cache.get());
+	}  else  {
+	    AnalyzeBinary(*jsonFile, cache.get());
+	}
+	if (compressor && !compressor->Finish())  {
+	    throw runtime_error{"error compressing or writing the output"};
+	}
+    }  catch (exception &e)  {
+	options.Error(string{e.what()} + '\n');
+    }
+
+    if (options.stats)  {
+	ofstream statsFile;
+	if (options.statsFile)  {
+	    statsFile.open(options.statsFile);
+	    if (!statsFile)  {
+		options.Error(string{"Error opening stats file '"} + options.statsFile + "'\n");
+	    }
+	}
+	runStats.WriteJson(options.statsFile ? statsFile : clog);
+    }
+
+    if (options.maxMemory || options.timing)  {
+	clog << "memory:    peak RSS " << (MemoryUsage::PeakRss() >> 20) << " MiB";
+	if (options.maxMemory)  {
+	    clog << " (--max-memory " << (options.maxMemory >> 20) << " MiB)";
+	}
+	clog << '\n';
     }
-    writer.CloseArray();
-    writer.CloseObject();
-    writer.End();
 }
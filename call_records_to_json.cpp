@@ -0,0 +1,120 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Converts the output of call_analyzer --format binary to the JSON that
+// call_analyzer would have written.  It does not need Dyninst.
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "jsonWriter.h"
+#include "registerMask.h"
+#include "functionRecord.h"
+#include "recordFile.h"
+
+
+// Writes the records from in to out as JSON, returning the number of
+// functions.
+size_t ConvertRecords(std::istream &in, std::ostream &out, int indent)
+{
+    RecordFileReader reader(in);
+    JsonWriter writer(out, indent);
+    writer.OpenObject();
+    writer.AddMemberKey("functions");
+    writer.OpenArray();
+
+    size_t numFuncs = 0;
+    FunctionRecord f;
+    while (reader.Read(f))  {
+	f.WriteJson(writer);
+	++numFuncs;
+    }
+
+    writer.CloseArray();
+    writer.CloseObject();
+    writer.End();
+
+    return numFuncs;
+}
+
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+
+    const char *programName = argv[0] ? argv[0] : "call_records_to_json";
+    int indent = 2;
+    bool showSignature = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i)  {
+	if (!strcmp("--compact-json", argv[i]))  {
+	    indent = 0;
+	}  else if (!strcmp("--signature", argv[i]))  {
+	    showSignature = true;
+	}  else if (!strcmp("--", argv[i]))  {
+	    ++i;
+	    break;
+	}  else  {
+	    clog << "Usage: " << programName << " [options] [infile [outfile]]\n"
+		<< "  --compact-json   minify json output\n"
+		<< "  --signature      print the options the records were produced with\n"
+		<< "infile is the output of call_analyzer --format binary (default stdin)\n";
+	    return strcmp("--help", argv[i]) ? 1 : 0;
+	}
+    }
+
+    istream *in = &cin;
+    ifstream inputFile;
+    if (i < argc && strcmp(argv[i], "-"))  {
+	inputFile.open(argv[i], ios::binary);
+	if (!inputFile)  {
+	    clog << programName << ": Error opening input file '" << argv[i] << "'\n";
+	    return 1;
+	}
+	in = &inputFile;
+    }
+
+    ostream *out = &cout;
+    ofstream outputFile;
+    if (i + 1 < argc)  {
+	outputFile.open(argv[i + 1]);
+	if (!outputFile)  {
+	    clog << programName << ": Error opening output file '" << argv[i + 1] << "'\n";
+	    return 1;
+	}
+	out = &outputFile;
+    }
+
+    try  {
+	if (showSignature)  {
+	    RecordFileReader reader(*in);
+	    *out << reader.Signature() << '\n';
+	}  else  {
+	    ConvertRecords(*in, *out, indent);
+	}
+    }  catch (exception &e)  {
+	clog << programName << ": " << e.what() << '\n';
+	return 1;
+    }
+
+    if (!out->flush())  {
+	clog << programName << ": Error writing output\n";
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Streaming gzip (zlib) and zstd compression of the output.  zstd is only
+// available if compiled with WITH_ZSTD defined (and linked with -lzstd).
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+
+// Compresses the output and passes it on to another streambuf.  The output
+// is collected in chunks that a thread of its own compresses and writes, so
+// compressing overlaps with producing the output.  At most maxChunks chunks
+// are waiting, after that producing more waits for the thread.  The
+// compressed stream is only flushed when Finish ends it:  flushing it
+// earlier, as every sync of the stream would, costs compression ratio, so
+// sync only reports a failure.  Finish returns false if compressing or
+// writing failed; after a failure the output is discarded and writes fail.
+class CompressingStreambuf : public std::streambuf
+{
+    public:
+	enum Codec  {none, gzip, zstd};
+
+	CompressingStreambuf(std::streambuf *out, Codec codec, int level);
+	~CompressingStreambuf();
+	CompressingStreambuf(const CompressingStreambuf &) = delete;
+	CompressingStreambuf &operator=(const CompressingStreambuf &) = delete;
+	bool Finish();
+	static bool ParseSpec(const std::string &spec, Codec &codec, int &level);
+	static Codec CodecForPath(const std::string &path);
+	static int DefaultLevel(Codec codec)
+	{
+	    return codec == zstd ? 3 : 6;
+	}
+	static bool IsAvailable(Codec codec);
+    protected:
+	int_type overflow(int_type c) override;
+	int sync() override;
+    private:
+	static const size_t	chunkSize = 1 << 20;
+	static const size_t	maxChunks = 4;
+
+	enum Mode  {writeMode, finishMode};
+	struct Chunk
+	{
+	    std::string		data;
+	    Mode		mode;
+	};
+
+	void		Queue(Mode mode);
+	void		Compressor();
+	bool		Compress(const std::string &data, Mode mode);
+	bool		Write(const char *data, size_t len);
+
+	std::streambuf			*out;
+	Codec				codec;
+	z_stream			zs{};
+#ifdef WITH_ZSTD
+	ZSTD_CCtx			*zctx = nullptr;
+#endif
+	std::string			current;
+	std::vector<char>		compressed;
+	std::mutex			mutex;
+	std::condition_variable		queued;
+	std::condition_variable		taken;
+	std::deque<Chunk>		chunks;
+	std::vector<std::string>	spare;
+	std::atomic<bool>		failed{false};
+	bool				finished = false;
+	std::thread			thread;
+};
+
+
+CompressingStreambuf::CompressingStreambuf(std::streambuf *out, Codec codec, int level)
+    :
+	out(out),
+	codec(codec),
+	compressed(chunkSize)
+{
+    if (codec == gzip)  {
+	// 16 + 15:  a gzip header and trailer, with the largest window
+	if (deflateInit2(&zs, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)  {
+	    failed = true;
+	}
+#ifdef WITH_ZSTD
+    }  else if (codec == zstd)  {
+	zctx = ZSTD_createCCtx();
+	if (!zctx || ZSTD_isError(ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel, level)))  {
+	    failed = true;
+	}
+#endif
+    }  else  {
+	failed = true;
+    }
+
+    current.resize(chunkSize);
+    setp(&current[0], &current[0] + current.size());
+    thread = std::thread(&CompressingStreambuf::Compressor, this);
+}
+
+
+CompressingStreambuf::~CompressingStreambuf()
+{
+    Finish();
+    if (codec == gzip)  {
+	deflateEnd(&zs);
+    }
+#ifdef WITH_ZSTD
+    ZSTD_freeCCtx(zctx);
+#endif
+}
+
+
+// Compresses the rest of the output, ends the compressed stream and waits
+// for it to be written.  Returns false if anything failed.
+bool CompressingStreambuf::Finish()
+{
+    if (!finished)  {
+	Queue(finishMode);
+	thread.join();
+	finished = true;
+	setp(nullptr, nullptr);
+    }
+
+    return !failed;
+}
+
+
+// Parses "CODEC" or "CODEC:LEVEL", where CODEC is gzip, zstd or none, and
+// LEVEL is 0 to 9 for gzip or 1 to 22 for zstd.  Returns false if the spec
+// is invalid.
+bool CompressingStreambuf::ParseSpec(const std::string &spec, Codec &codec, int &level)
+{
+    auto colon = spec.find(':');
+    auto name = spec.substr(0, colon);
+    if (name == "gzip")  {
+	codec = gzip;
+    }  else if (name == "zstd")  {
+	codec = zstd;
+    }  else if (name == "none" && colon == std::string::npos)  {
+	codec = none;
+	return true;
+    }  else  {
+	return false;
+    }
+
+    level = DefaultLevel(codec);
+    if (colon == std::string::npos)  {
+	return true;
+    }
+    auto levelStr = spec.substr(colon + 1);
+    char *end;
+    level = strtol(levelStr.c_str(), &end, 10);
+    if (levelStr.empty() || *end != '\0')  {
+	return false;
+    }
+
+    return codec == gzip ? level >= 0 && level <= 9 : level >= 1 && level <= 22;
+}
+
+
+// Returns the codec for an output file name ending in .gz or .zst, or none.
+CompressingStreambuf::Codec CompressingStreambuf::CodecForPath(const std::string &path)
+{
+    auto endsWith = [&path](const std::string &suffix)  {
+	return path.size() > suffix.size()
+		&& !path.compare(path.size() - suffix.size(), suffix.size(), suffix);
+    };
+
+    if (endsWith(".gz"))  {
+	return gzip;
+    }  else if (endsWith(".zst") || endsWith(".zstd"))  {
+	return zstd;
+    }
+
+    return none;
+}
+
+
+bool CompressingStreambuf::IsAvailable(Codec codec)
+{
+#ifdef WITH_ZSTD
+    return codec == gzip || codec == zstd || codec == none;
+#else
+    return codec != zstd;
+#endif
+}
+
+
+CompressingStreambuf::int_type CompressingStreambuf::overflow(int_type c)
+{
+    if (failed || finished)  {
+	return traits_type::eof();
+    }
+
+    Queue(writeMode);
+    if (!traits_type::eq_int_type(c, traits_type::eof()))  {
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+
+int CompressingStreambuf::sync()
+{
+    return failed || finished ? -1 : 0;
+}
+
+
+// Queues the current chunk for the compressor thread, waiting if it is
+// behind, and starts a new one.
+void CompressingStreambuf::Queue(Mode mode)
+{
+    current.resize(pptr() - pbase());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    taken.wait(lock, [this]  {
+	return chunks.size() < maxChunks;
+    });
+    chunks.push_back({std::move(current), mode});
+    if (!spare.empty())  {
+	current = std::move(spare.back());
+	spare.pop_back();
+    }  else  {
+	current = std::string{};
+    }
+    lock.unlock();
+    queued.notify_one();
+
+    current.resize(chunkSize);
+    setp(&current[0], &current[0] + current.size());
+}
+
+
+// The compressor thread:  compresses and writes the chunks until the last.
+void CompressingStreambuf::Compressor()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)  {
+	queued.wait(lock, [this]  {
+	    return !chunks.empty();
+	});
+	auto chunk = std::move(chunks.front());
+	chunks.pop_front();
+	lock.unlock();
+	taken.notify_one();
+
+	if (!failed && !Compress(chunk.data, chunk.mode))  {
+	    failed = true;
+	}
+
+	lock.lock();
+	if (chunk.mode == finishMode)  {
+	    return;
+	}
+	spare.push_back(std::move(chunk.data));
+    }
+}
+
+
+// Compresses the data and writes what is produced, ending the compressed
+// stream in finishMode.
+bool CompressingStreambuf::Compress(const std::string &data, Mode mode)
+{
+    if (codec == gzip)  {
+	int flush = mode == finishMode ? Z_FINISH : Z_NO_FLUSH;
+	zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+	zs.avail_in = data.size();
+	for (;;)  {
+	    zs.next_out = reinterpret_cast<Bytef *>(compressed.data());
+	    zs.avail_out = compressed.size();
+	    auto r = deflate(&zs, flush);
+	    if (r == Z_STREAM_ERROR || !Write(compressed.data(), compressed.size() - zs.avail_out))  {
+		return false;
+	    }
+	    if (flush == Z_FINISH ? r == Z_STREAM_END : zs.avail_out != 0)  {
+		break;
+	    }
+	}
+#ifdef WITH_ZSTD
+    }  else if (codec == zstd)  {
+	auto directive = mode == finishMode ? ZSTD_e_end : ZSTD_e_continue;
+	ZSTD_inBuffer in{data.data(), data.size(), 0};
+	for (;;)  {
+	    ZSTD_outBuffer zout{compressed.data(), compressed.size(), 0};
+	    auto remaining = ZSTD_compressStream2(zctx, &zout, &in, directive);
+	    if (ZSTD_isError(remaining) || !Write(compressed.data(), zout.pos))  {
+		return false;
+	    }
+	    if (directive == ZSTD_e_continue ? in.pos == in.size : remaining == 0)  {
+		break;
+	    }
+	}
+#endif
+    }  else  {
+	return false;
+    }
+
+    return mode != finishMode || out->pubsync() != -1;
+}
+
+
+bool CompressingStreambuf::Write(const char *data, size_t len)
+{
+    return out->sputn(data, len) == std::streamsize(len);
+}
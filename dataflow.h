@@ -0,0 +1,330 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+
+// A directed graph of nodes numbered [0, NumNodes()) with the predecessors
+// and successors of each node stored contiguously (compressed sparse rows).
+class DataflowGraph
+{
+    public:
+	using Node = uint32_t;
+
+	// a contiguous range of nodes
+	struct Nodes
+	{
+	    const Node	*first;
+	    const Node	*last;
+	    const Node *begin() const
+	    {
+		return first;
+	    }
+	    const Node *end() const
+	    {
+		return last;
+	    }
+	    size_t size() const
+	    {
+		return last - first;
+	    }
+	};
+
+	void Build(size_t numNodes, const std::vector<std::pair<Node, Node>> &edges);
+	size_t NumNodes() const
+	{
+	    return predOffsets.empty() ? 0 : predOffsets.size() - 1;
+	}
+	Nodes Predecessors(Node n) const
+	{
+	    return {&preds[predOffsets[n]], &preds[predOffsets[n + 1]]};
+	}
+	Nodes Successors(Node n) const
+	{
+	    return {&succs[succOffsets[n]], &succs[succOffsets[n + 1]]};
+	}
+	std::vector<Node> ReversePostorder(Node entry, bool backward = false) const;
+	size_t Components(std::vector<Node> &component) const;
+    private:
+	static void	BuildRows(size_t numNodes, const std::vector<std::pair<Node, Node>> &edges,
+			    bool bySource, std::vector<Node> &offsets, std::vector<Node> &nodes);
+
+	std::vector<Node>	predOffsets;
+	std::vector<Node>	preds;
+	std::vector<Node>	succOffsets;
+	std::vector<Node>	succs;
+};
+
+
+// Solves a monotone dataflow problem over a DataflowGraph, computing the
+// least fixed point of
+//
+//	in[n] = Meet(out[p]) over the predecessors p of n  (bottom if none)
+//	out[n] = transfer(n, in[n])
+//
+// (predecessors and successors are swapped for a backward problem).  Value
+// is default constructed as bottom and must support |= as the meet and ==.
+// Nodes are processed in reverse postorder from the entry using a priority
+// worklist, and the out value of each node is cached so a node's successors
+// are only revisited when its out value changes.
+template <typename Value>
+class DataflowSolver
+{
+    public:
+	using Node = DataflowGraph::Node;
+	using Transfer = std::function<Value(Node, const Value &)>;
+
+	struct Stats
+	{
+	    size_t	iterations = 0;		// nodes taken from the worklist
+	    size_t	changes = 0;		// out values changed after the initial value
+	};
+
+	DataflowSolver(const DataflowGraph &g, bool backward = false)
+	    : graph(g), backward(backward)
+	    {}
+	Stats Solve(Node entry, Transfer transfer);
+	const Value &In(Node n) const
+	{
+	    return in[n];
+	}
+	const Value &Out(Node n) const
+	{
+	    return out[n];
+	}
+    private:
+	DataflowGraph::Nodes Sources(Node n) const
+	{
+	    return backward ? graph.Successors(n) : graph.Predecessors(n);
+	}
+	DataflowGraph::Nodes Sinks(Node n) const
+	{
+	    return backward ? graph.Predecessors(n) : graph.Successors(n);
+	}
+
+	const DataflowGraph	&graph;
+	bool			backward;
+	std::vector<Value>	in;
+	std::vector<Value>	out;
+};
+
+
+void DataflowGraph::Build(size_t numNodes, const std::vector<std::pair<Node, Node>> &edges)
+{
+    BuildRows(numNodes, edges, false, predOffsets, preds);
+    BuildRows(numNodes, edges, true, succOffsets, succs);
+}
+
+
+// Builds the rows of the edges (source, target) indexed by target, or by
+// source if bySource.  Each row keeps the order of the edges.
+void DataflowGraph::BuildRows(
+	size_t numNodes,
+	const std::vector<std::pair<Node, Node>> &edges,
+	bool bySource,
+	std::vector<Node> &offsets,
+	std::vector<Node> &nodes
+    )
+{
+    offsets.assign(numNodes + 1, 0);
+    for (auto &e: edges)  {
+	++offsets[(bySource ? e.first : e.second) + 1];
+    }
+    for (size_t i = 0; i < numNodes; ++i)  {
+	offsets[i + 1] += offsets[i];
+    }
+
+    nodes.resize(edges.size());
+    std::vector<Node> next(offsets.begin(), offsets.end() - 1);
+    for (auto &e: edges)  {
+	auto row = bySource ? e.first : e.second;
+	nodes[next[row]++] = bySource ? e.second : e.first;
+    }
+}
+
+
+// Returns every node in reverse postorder of a depth first search from
+// entry followed by the nodes unreachable from entry, each group in order
+// of their own reverse postorder.  For a backward problem the search
+// follows predecessors.
+std::vector<DataflowGraph::Node> DataflowGraph::ReversePostorder(Node entry, bool backward) const
+{
+    auto numNodes = NumNodes();
+    std::vector<Node> postorder;
+    std::vector<bool> visited(numNodes);
+    std::vector<std::pair<Node, size_t>> stack;
+
+    auto search = [&](Node root)  {
+	visited[root] = true;
+	stack.emplace_back(root, 0);
+	while (!stack.empty())  {
+	    auto &top = stack.back();
+	    auto next = backward ? Predecessors(top.first) : Successors(top.first);
+	    if (top.second < next.size())  {
+		auto n = next.begin()[top.second++];
+		if (!visited[n])  {
+		    visited[n] = true;
+		    stack.emplace_back(n, 0);
+		}
+	    }  else  {
+		postorder.push_back(top.first);
+		stack.pop_back();
+	    }
+	}
+    };
+
+    std::vector<Node> order;
+    if (entry < numNodes)  {
+	search(entry);
+	order.assign(postorder.rbegin(), postorder.rend());
+    }
+    for (Node n = 0; n < numNodes; ++n)  {
+	if (!visited[n])  {
+	    postorder.clear();
+	    search(n);
+	    order.insert(order.end(), postorder.rbegin(), postorder.rend());
+	}
+    }
+
+    return order;
+}
+
+
+// Finds the strongly connected components of the graph (Tarjan's
+// algorithm), setting component[n] to the number of n's component, and
+// returns the number of components.  Components are numbered in reverse
+// topological order:  every edge leads to a node of the same component or
+// of one with a smaller number.
+size_t DataflowGraph::Components(std::vector<Node> &component) const
+{
+    const Node none = Node(-1);
+    auto numNodes = NumNodes();
+    std::vector<Node> index(numNodes, none);
+    std::vector<Node> lowLink(numNodes);
+    std::vector<Node> open;
+    std::vector<std::pair<Node, size_t>> stack;
+    Node nextIndex = 0;
+    size_t numComponents = 0;
+
+    component.assign(numNodes, none);
+    auto visit = [&](Node n)  {
+	index[n] = lowLink[n] = nextIndex++;
+	open.push_back(n);
+	stack.emplace_back(n, 0);
+    };
+
+    for (Node root = 0; root < numNodes; ++root)  {
+	if (index[root] != none)  {
+	    continue;
+	}
+	visit(root);
+	while (!stack.empty())  {
+	    auto n = stack.back().first;
+	    auto next = Successors(n);
+	    if (stack.back().second < next.size())  {
+		auto s = next.begin()[stack.back().second++];
+		if (index[s] == none)  {
+		    visit(s);
+		}  else if (component[s] == none)  {
+		    // s is open, so it is in n's component
+		    lowLink[n] = std::min(lowLink[n], index[s]);
+		}
+		continue;
+	    }
+
+	    stack.pop_back();
+	    if (!stack.empty())  {
+		auto parent = stack.back().first;
+		lowLink[parent] = std::min(lowLink[parent], lowLink[n]);
+	    }
+	    if (lowLink[n] == index[n])  {
+		Node m;
+		do  {
+		    m = open.back();
+		    open.pop_back();
+		    component[m] = numComponents;
+		}  while (m != n);
+		++numComponents;
+	    }
+	}
+    }
+
+    return numComponents;
+}
+
+
+template <typename Value>
+typename DataflowSolver<Value>::Stats DataflowSolver<Value>::Solve(Node entry, Transfer transfer)
+{
+    Stats stats;
+    auto numNodes = graph.NumNodes();
+
+    // priority[n] is n's position in reverse postorder
+    auto order = graph.ReversePostorder(entry, backward);
+    std::vector<Node> priority(numNodes);
+    for (Node i = 0; i < order.size(); ++i)  {
+	priority[order[i]] = i;
+    }
+
+    in.assign(numNodes, Value{});
+    out.resize(numNodes);
+    for (Node n = 0; n < numNodes; ++n)  {
+	out[n] = transfer(n, in[n]);
+    }
+
+    // the worklist holds priorities, smallest first
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> worklist;
+    std::vector<bool> queued(numNodes, true);
+    for (Node i = 0; i < numNodes; ++i)  {
+	worklist.push(i);
+    }
+
+    while (!worklist.empty())  {
+	auto n = order[worklist.top()];
+	worklist.pop();
+	queued[n] = false;
+	++stats.iterations;
+
+	Value newIn{};
+	for (auto s: Sources(n))  {
+	    newIn |= out[s];
+	}
+	if (newIn == in[n])  {
+	    continue;
+	}
+	in[n] = newIn;
+
+	auto newOut = transfer(n, in[n]);
+	if (newOut == out[n])  {
+	    continue;
+	}
+	out[n] = newOut;
+	++stats.changes;
+
+	for (auto s: Sinks(n))  {
+	    if (!queued[s])  {
+		queued[s] = true;
+		worklist.push(priority[s]);
+	    }
+	}
+    }
+
+    return stats;
+}
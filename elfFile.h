@@ -0,0 +1,384 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <elf.h>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Reads just enough of an ELF file to answer questions that do not need
+// SymtabAPI, so they are cheap to ask before deciding to analyze the file.
+// Only files in the host byte order are understood.
+class ElfFile
+{
+    public:
+	ElfFile(const std::string &path);
+	bool IsValid() const
+	{
+	    return valid;
+	}
+	int Class() const
+	{
+	    return valid ? ident[EI_CLASS] : ELFCLASSNONE;
+	}
+	unsigned Machine();
+	bool BuildId(std::string &hexId);
+	bool SymbolNames(std::vector<std::string> &names);
+	bool Dependencies(std::vector<std::string> &needed, std::string &rpath, std::string &runpath);
+	bool ExportedFunctions(std::map<std::string, uint64_t> &functions);
+    private:
+	template <typename Ehdr, typename Phdr, typename Nhdr>
+	bool		FindBuildId(std::string &hexId);
+	template <typename Ehdr, typename Shdr>
+	bool		ReadSectionHeaders(std::vector<Shdr> &shdrs);
+	template <typename Shdr>
+	bool		ReadStrings(const std::vector<Shdr> &shdrs, size_t index, std::vector<char> &strings);
+	template <typename Ehdr, typename Shdr, typename Sym>
+	bool		FindSymbolNames(std::vector<std::string> &names);
+	template <typename Ehdr, typename Shdr, typename Dyn>
+	bool		FindDependencies(std::vector<std::string> &needed, std::string &rpath, std::string &runpath);
+	template <typename Ehdr, typename Shdr, typename Sym>
+	bool		FindExportedFunctions(std::map<std::string, uint64_t> &functions);
+	bool		Read(uint64_t offset, void *buf, size_t len);
+
+	std::ifstream	file;
+	unsigned char	ident[EI_NIDENT];
+	bool		valid = false;
+};
+
+
+ElfFile::ElfFile(const std::string &path)
+    :
+	file(path, std::ios::binary)
+{
+    if (!Read(0, ident, sizeof ident) || memcmp(ident, ELFMAG, SELFMAG))  {
+	return;
+    }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    int hostData = ELFDATA2LSB;
+#else
+    int hostData = ELFDATA2MSB;
+#endif
+    valid = (ident[EI_DATA] == hostData)
+	    && (ident[EI_CLASS] == ELFCLASS32 || ident[EI_CLASS] == ELFCLASS64);
+}
+
+
+// Returns the machine (EM_X86_64, ...) or EM_NONE if it is unknown.  It is
+// at the same offset in 32 and 64 bit files.
+unsigned ElfFile::Machine()
+{
+    uint16_t machine;
+    if (!valid || !Read(offsetof(Elf64_Ehdr, e_machine), &machine, sizeof machine))  {
+	return EM_NONE;
+    }
+
+    return machine;
+}
+
+
+// Returns the GNU build-id note (NT_GNU_BUILD_ID) as a hex string.
+bool ElfFile::BuildId(std::string &hexId)
+{
+    if (!valid)  {
+	return false;
+    }
+
+    if (ident[EI_CLASS] == ELFCLASS64)  {
+	return FindBuildId<Elf64_Ehdr, Elf64_Phdr, Elf64_Nhdr>(hexId);
+    }  else  {
+	return FindBuildId<Elf32_Ehdr, Elf32_Phdr, Elf32_Nhdr>(hexId);
+    }
+}
+
+
+template <typename Ehdr, typename Phdr, typename Nhdr>
+bool ElfFile::FindBuildId(std::string &hexId)
+{
+    Ehdr ehdr;
+    if (!Read(0, &ehdr, sizeof ehdr) || ehdr.e_phentsize != sizeof(Phdr))  {
+	return false;
+    }
+
+    for (unsigned i = 0; i < ehdr.e_phnum; ++i)  {
+	Phdr phdr;
+	if (!Read(ehdr.e_phoff + i * sizeof phdr, &phdr, sizeof phdr))  {
+	    return false;
+	}
+	if (phdr.p_type != PT_NOTE || phdr.p_filesz > (1 << 20))  {
+	    continue;
+	}
+
+	std::vector<unsigned char> notes(phdr.p_filesz);
+	if (!Read(phdr.p_offset, notes.data(), notes.size()))  {
+	    return false;
+	}
+
+	// notes are a header, a name and a descriptor each padded to 4 bytes
+	auto align4 = [](size_t n)  { return (n + 3) & ~size_t(3); };
+	size_t pos = 0;
+	while (pos + sizeof(Nhdr) <= notes.size())  {
+	    Nhdr nhdr;
+	    memcpy(&nhdr, &notes[pos], sizeof nhdr);
+	    auto namePos = pos + sizeof nhdr;
+	    auto descPos = namePos + align4(nhdr.n_namesz);
+	    pos = descPos + align4(nhdr.n_descsz);
+	    if (pos > notes.size())  {
+		break;
+	    }
+	    if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == sizeof ELF_NOTE_GNU
+		    && !memcmp(&notes[namePos], ELF_NOTE_GNU, sizeof ELF_NOTE_GNU)
+		    && nhdr.n_descsz > 0)  {
+		static const char hexDigits[] = "0123456789abcdef";
+		hexId.clear();
+		for (size_t j = 0; j < nhdr.n_descsz; ++j)  {
+		    hexId += hexDigits[notes[descPos + j] >> 4];
+		    hexId += hexDigits[notes[descPos + j] & 0xf];
+		}
+		return true;
+	    }
+	}
+    }
+
+    return false;
+}
+
+
+// Appends the names of the symbols in the symbol tables (.symtab and
+// .dynsym), skipping empty names.
+bool ElfFile::SymbolNames(std::vector<std::string> &names)
+{
+    if (!valid)  {
+	return false;
+    }
+
+    if (ident[EI_CLASS] == ELFCLASS64)  {
+	return FindSymbolNames<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym>(names);
+    }  else  {
+	return FindSymbolNames<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym>(names);
+    }
+}
+
+
+template <typename Ehdr, typename Shdr>
+bool ElfFile::ReadSectionHeaders(std::vector<Shdr> &shdrs)
+{
+    Ehdr ehdr;
+    if (!Read(0, &ehdr, sizeof ehdr) || ehdr.e_shentsize != sizeof(Shdr))  {
+	return false;
+    }
+
+    shdrs.resize(ehdr.e_shnum);
+    return Read(ehdr.e_shoff, shdrs.data(), shdrs.size() * sizeof(Shdr));
+}
+
+
+// Reads the string table in section index, with a terminating null added
+// so a string at any offset before the end is terminated.
+template <typename Shdr>
+bool ElfFile::ReadStrings(const std::vector<Shdr> &shdrs, size_t index, std::vector<char> &strings)
+{
+    if (index >= shdrs.size() || shdrs[index].sh_size > (uint64_t(1) << 32))  {
+	return false;
+    }
+
+    auto &strShdr = shdrs[index];
+    strings.assign(strShdr.sh_size + 1, '\0');
+    return Read(strShdr.sh_offset, strings.data(), strShdr.sh_size);
+}
+
+
+template <typename Ehdr, typename Shdr, typename Sym>
+bool ElfFile::FindSymbolNames(std::vector<std::string> &names)
+{
+    std::vector<Shdr> shdrs;
+    if (!ReadSectionHeaders<Ehdr>(shdrs))  {
+	return false;
+    }
+
+    for (auto &shdr: shdrs)  {
+	if ((shdr.sh_type != SHT_SYMTAB && shdr.sh_type != SHT_DYNSYM)
+		|| shdr.sh_link >= shdrs.size() || shdr.sh_entsize != sizeof(Sym))  {
+	    continue;
+	}
+
+	std::vector<char> strings;
+	std::vector<Sym> syms(shdr.sh_size / sizeof(Sym));
+	if (!ReadStrings(shdrs, shdr.sh_link, strings)
+		|| !Read(shdr.sh_offset, syms.data(), syms.size() * sizeof(Sym)))  {
+	    return false;
+	}
+	for (auto &sym: syms)  {
+	    if (sym.st_name > 0 && sym.st_name + 1 < strings.size())  {
+		names.emplace_back(&strings[sym.st_name]);
+	    }
+	}
+    }
+
+    return true;
+}
+
+
+// Returns the shared libraries the file needs (DT_NEEDED) in order, and its
+// DT_RPATH and DT_RUNPATH search paths (empty if not present), from the
+// .dynamic section.  A file without one needs nothing.
+bool ElfFile::Dependencies(std::vector<std::string> &needed, std::string &rpath, std::string &runpath)
+{
+    if (!valid)  {
+	return false;
+    }
+
+    if (ident[EI_CLASS] == ELFCLASS64)  {
+	return FindDependencies<Elf64_Ehdr, Elf64_Shdr, Elf64_Dyn>(needed, rpath, runpath);
+    }  else  {
+	return FindDependencies<Elf32_Ehdr, Elf32_Shdr, Elf32_Dyn>(needed, rpath, runpath);
+    }
+}
+
+
+template <typename Ehdr, typename Shdr, typename Dyn>
+bool ElfFile::FindDependencies(std::vector<std::string> &needed, std::string &rpath, std::string &runpath)
+{
+    std::vector<Shdr> shdrs;
+    if (!ReadSectionHeaders<Ehdr>(shdrs))  {
+	return false;
+    }
+
+    for (auto &shdr: shdrs)  {
+	if (shdr.sh_type != SHT_DYNAMIC || shdr.sh_entsize != sizeof(Dyn))  {
+	    continue;
+	}
+
+	std::vector<char> strings;
+	std::vector<Dyn> dyns(shdr.sh_size / sizeof(Dyn));
+	if (!ReadStrings(shdrs, shdr.sh_link, strings)
+		|| !Read(shdr.sh_offset, dyns.data(), dyns.size() * sizeof(Dyn)))  {
+	    return false;
+	}
+	for (auto &dyn: dyns)  {
+	    if (dyn.d_tag == DT_NULL)  {
+		break;
+	    }
+	    if (dyn.d_un.d_val + 1 >= strings.size())  {
+		continue;
+	    }
+	    const char *str = &strings[dyn.d_un.d_val];
+	    if (dyn.d_tag == DT_NEEDED)  {
+		needed.emplace_back(str);
+	    }  else if (dyn.d_tag == DT_RPATH)  {
+		rpath = str;
+	    }  else if (dyn.d_tag == DT_RUNPATH)  {
+		runpath = str;
+	    }
+	}
+    }
+
+    return true;
+}
+
+
+// Adds the functions defined and exported by the file, by name, with their
+// addresses:  the global and weak function symbols in .dynsym that are
+// visible to other files.  A name with several versions gets the address
+// of the default version.
+bool ElfFile::ExportedFunctions(std::map<std::string, uint64_t> &functions)
+{
+    if (!valid)  {
+	return false;
+    }
+
+    if (ident[EI_CLASS] == ELFCLASS64)  {
+	return FindExportedFunctions<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym>(functions);
+    }  else  {
+	return FindExportedFunctions<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym>(functions);
+    }
+}
+
+
+template <typename Ehdr, typename Shdr, typename Sym>
+bool ElfFile::FindExportedFunctions(std::map<std::string, uint64_t> &functions)
+{
+    std::vector<Shdr> shdrs;
+    if (!ReadSectionHeaders<Ehdr>(shdrs))  {
+	return false;
+    }
+
+    for (size_t i = 0; i < shdrs.size(); ++i)  {
+	auto &shdr = shdrs[i];
+	if (shdr.sh_type != SHT_DYNSYM || shdr.sh_entsize != sizeof(Sym))  {
+	    continue;
+	}
+
+	std::vector<char> strings;
+	std::vector<Sym> syms(shdr.sh_size / sizeof(Sym));
+	if (!ReadStrings(shdrs, shdr.sh_link, strings)
+		|| !Read(shdr.sh_offset, syms.data(), syms.size() * sizeof(Sym)))  {
+	    return false;
+	}
+
+	// the symbol versions, if any, mark the non-default versions hidden
+	std::vector<Elf64_Half> versyms;
+	for (auto &v: shdrs)  {
+	    if (v.sh_type == SHT_GNU_versym && v.sh_link == i && v.sh_size == syms.size() * sizeof(Elf64_Half))  {
+		versyms.resize(syms.size());
+		if (!Read(v.sh_offset, versyms.data(), v.sh_size))  {
+		    versyms.clear();
+		}
+	    }
+	}
+
+	std::set<std::string> hidden;
+	for (size_t j = 0; j < syms.size(); ++j)  {
+	    auto &sym = syms[j];
+	    auto type = ELF64_ST_TYPE(sym.st_info);
+	    auto bind = ELF64_ST_BIND(sym.st_info);
+	    auto visibility = ELF64_ST_VISIBILITY(sym.st_other);
+	    if (sym.st_shndx == SHN_UNDEF || sym.st_name == 0 || sym.st_name + 1 >= strings.size()
+		    || (type != STT_FUNC && type != STT_GNU_IFUNC)
+		    || (bind != STB_GLOBAL && bind != STB_WEAK && bind != STB_GNU_UNIQUE)
+		    || (visibility != STV_DEFAULT && visibility != STV_PROTECTED))  {
+		continue;
+	    }
+
+	    std::string name{&strings[sym.st_name]};
+	    bool isHidden = !versyms.empty() && (versyms[j] & 0x8000);
+	    auto f = functions.find(name);
+	    if (f == functions.end())  {
+		functions.emplace(name, sym.st_value);
+		if (isHidden)  {
+		    hidden.insert(name);
+		}
+	    }  else if (!isHidden && hidden.erase(name))  {
+		f->second = sym.st_value;
+	    }
+	}
+    }
+
+    return true;
+}
+
+
+bool ElfFile::Read(uint64_t offset, void *buf, size_t len)
+{
+    file.clear();
+    file.seekg(offset);
+    return bool(file.read(static_cast<char *>(buf), len));
+}
@@ -0,0 +1,417 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// The results for a function as plain data, independent of Dyninst, so they
+// can be written in any output format or saved and reused by a later run.
+// Requires jsonWriter.h and registerMask.h.
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+using RecordAddress = unsigned long;
+const RecordAddress noRecordAddress = RecordAddress(-1);
+
+
+// The names the call records of a binary refer to by number:  the names of
+// called functions, numbered as they are first added, and the names of the
+// registers, where register i is bit i of a call's register masks.  Any
+// thread can add and look up function names.  The register names are set
+// before records using them are made.
+class RecordNames
+{
+    public:
+	using Id = uint32_t;
+
+	RecordNames() = default;
+	RecordNames(const std::vector<std::string> &registers)
+	    : registers(registers)
+	    {}
+	RecordNames(const RecordNames &) = delete;
+	RecordNames &operator=(const RecordNames &) = delete;
+	Id Add(const std::string &name);
+	const std::string &Name(Id id) const
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    return names[id];
+	}
+	const std::string &Register(size_t bit) const
+	{
+	    static const std::string none;
+	    return bit < registers.size() ? registers[bit] : none;
+	}
+	void SetRegister(size_t bit, const std::string &name);
+    private:
+	mutable std::mutex				mutex;
+	std::deque<std::string>				names;
+	std::unordered_map<std::string_view, Id>	ids;
+	std::vector<std::string>			registers;
+};
+
+
+// liveRegs are the parameter registers used in the call's block.  setRegs
+// are the parameter registers that may be set on some path to the call,
+// only with --interprocedural (hasSetRegs).  The registers and funcNames
+// refer to the RecordNames of the function's record.  library and
+// libraryAddr are where a call to the PLT resolves to, set only with
+// --dependencies.  They are only written as json.
+struct CallRecord
+{
+    RecordAddress			callInsnAddr = noRecordAddress;
+    RecordAddress			calledAddr = noRecordAddress;
+    bool				isToPlt = false;
+    bool				hasSetRegs = false;
+    RegisterMask			liveRegs;
+    RegisterMask			setRegs;
+    std::vector<RecordNames::Id>	funcNames;
+    std::string				library;
+    RecordAddress			libraryAddr = noRecordAddress;
+
+    void WriteJson(JsonWriter &writer, const RecordNames &names) const;
+};
+
+
+// names holds the names the calls refer to, shared by the records of a
+// binary (or of a file they were read from).
+struct FunctionRecord
+{
+    std::string				name;
+    RecordAddress			addr = noRecordAddress;
+    std::string				section;
+    bool				isInPlt = false;
+    std::vector<CallRecord>		calls;
+    std::shared_ptr<RecordNames>	names;
+
+    void WriteJson(JsonWriter &writer) const;
+};
+
+
+// What a later run needs to decide if a function's record can be reused:
+// the function's entry address, the ranges of its code relative to the
+// entry, the hash of the bytes in those ranges, and if it was found from a
+// symbol (or PLT entry) so it can be found again without parsing.
+struct FunctionState
+{
+    FunctionRecord			record;
+    RecordAddress			entry = noRecordAddress;
+    bool				hasSymbol = false;
+    std::string				codeHash;
+    std::vector<std::pair<long, unsigned long>>	codeRanges;
+
+    void Write(std::ostream &out) const;
+    bool Read(std::istream &in, const std::shared_ptr<RecordNames> &names);
+};
+
+
+// Reads and writes the state file, a line oriented text format:
+//
+//	call_analyzer-state 2 <output signature>
+//	F <entry> <hasSymbol> <hash> <ranges> <addr> <isInPlt> <section> <name>
+//	C <callInsnAddr> <calledAddr> <isToPlt> <liveRegs> <funcNames>...
+//
+// Fields are separated by tabs and escaped with a backslash.  An F line is
+// followed by a C line for each of the function's calls.  Ranges are
+// offset:length pairs separated by commas, liveRegs are bit:name pairs (the
+// register's bit in the mask and its name) separated by commas and each
+// funcName is a separate field.  Addresses are decimal, with "-" for
+// noRecordAddress.
+class StateFile
+{
+    public:
+	static void WriteHeader(std::ostream &out, const std::string &signature);
+	static bool ReadHeader(std::istream &in, const std::string &signature);
+	static std::string Escape(const std::string &s);
+	static std::vector<std::string> SplitLine(const std::string &line);
+	static std::string AddressString(RecordAddress a);
+	static RecordAddress ParseAddress(const std::string &s);
+};
+
+
+void WriteJsonAddressMember(JsonWriter &writer, const char *name, RecordAddress a)
+{
+    writer.AddMemberKey(name);
+    if (a != noRecordAddress)  {
+	writer.AddScalar(a);
+    }  else  {
+	writer.AddNull();
+    }
+}
+
+
+// Adds the number for the name, a new number if it has not been added.
+RecordNames::Id RecordNames::Add(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto i = ids.find(name);
+    if (i != ids.end())  {
+	return i->second;
+    }
+    names.push_back(name);
+    auto id = Id(names.size() - 1);
+    ids.emplace(names.back(), id);
+
+    return id;
+}
+
+
+void RecordNames::SetRegister(size_t bit, const std::string &name)
+{
+    if (bit >= registers.size())  {
+	registers.resize(bit + 1);
+    }
+    registers[bit] = name;
+}
+
+
+void WriteJsonRegistersMember(JsonWriter &writer, const char *name,
+	const RegisterMask &regs, const RecordNames &names)
+{
+    writer.AddMemberKey(name);
+    writer.OpenArray();
+    for (auto i = regs.FindFirst(); i < regs.numBits; i = regs.FindNext(i))  {
+	writer.AddScalar(names.Register(i));
+    }
+    writer.CloseArray();
+}
+
+
+void CallRecord::WriteJson(JsonWriter &writer, const RecordNames &names) const
+{
+    writer.OpenObject();
+    WriteJsonAddressMember(writer, "callInstructionAddr", callInsnAddr);
+    WriteJsonAddressMember(writer, "calledAddr", calledAddr);
+    writer.AddMemberKey("callToPlt");
+    writer.AddScalar(isToPlt);
+    WriteJsonRegistersMember(writer, "liveRegisters", liveRegs, names);
+    if (hasSetRegs)  {
+	WriteJsonRegistersMember(writer, "setRegisters", setRegs, names);
+    }
+    writer.AddMemberKey("funcNames");
+    writer.OpenArray();
+    for (auto id: funcNames)  {
+	writer.AddScalar(names.Name(id));
+    }
+    writer.CloseArray();
+    if (!library.empty())  {
+	writer.AddMemberKey("library");
+	writer.AddScalar(library);
+	WriteJsonAddressMember(writer, "libraryAddr", libraryAddr);
+    }
+    writer.CloseObject();
+}
+
+
+void FunctionRecord::WriteJson(JsonWriter &writer) const
+{
+    writer.OpenObject();
+    writer.AddMemberKey("funcName");
+    writer.AddScalar(name);
+    WriteJsonAddressMember(writer, "funcAddr", addr);
+    writer.AddMemberKey("sectionName");
+    writer.AddScalar(section);
+    writer.AddMemberKey("isInPlt");
+    writer.AddScalar(isInPlt);
+    writer.AddMemberKey("calls");
+    writer.OpenArray();
+    for (auto &call: calls)  {
+	call.WriteJson(writer, *names);
+    }
+    writer.CloseArray();
+    writer.CloseObject();
+}
+
+
+void FunctionState::Write(std::ostream &out) const
+{
+    using S = StateFile;
+
+    std::string ranges;
+    for (auto &r: codeRanges)  {
+	if (!ranges.empty())  {
+	    ranges += ',';
+	}
+	ranges += std::to_string(r.first) + ':' + std::to_string(r.second);
+    }
+
+    out << "F\t" << S::AddressString(entry) << '\t' << hasSymbol << '\t' << codeHash
+	<< '\t' << ranges << '\t' << S::AddressString(record.addr) << '\t' << record.isInPlt
+	<< '\t' << S::Escape(record.section) << '\t' << S::Escape(record.name) << '\n';
+
+    for (auto &call: record.calls)  {
+	std::string regs;
+	auto &regMask = call.liveRegs;
+	for (auto i = regMask.FindFirst(); i < regMask.numBits; i = regMask.FindNext(i))  {
+	    if (!regs.empty())  {
+		regs += ',';
+	    }
+	    regs += std::to_string(i) + ':' + record.names->Register(i);
+	}
+	out << "C\t" << S::AddressString(call.callInsnAddr) << '\t'
+	    << S::AddressString(call.calledAddr) << '\t' << call.isToPlt << '\t' << S::Escape(regs);
+	for (auto id: call.funcNames)  {
+	    out << '\t' << S::Escape(record.names->Name(id));
+	}
+	out << '\n';
+    }
+}
+
+
+// Reads the next function, adding the names its calls use to names.
+// Returns false at the end of the file or if the file is malformed.
+bool FunctionState::Read(std::istream &in, const std::shared_ptr<RecordNames> &names)
+{
+    using S = StateFile;
+
+    *this = FunctionState{};
+    record.names = names;
+
+    std::string line;
+    if (!std::getline(in, line))  {
+	return false;
+    }
+    auto f = S::SplitLine(line);
+    if (f.size() != 9 || f[0] != "F")  {
+	return false;
+    }
+    entry = S::ParseAddress(f[1]);
+    hasSymbol = (f[2] == "1");
+    codeHash = f[3];
+    size_t pos = 0;
+    while (pos < f[4].size())  {
+	char *end;
+	auto offset = strtol(f[4].c_str() + pos, &end, 10);
+	auto len = strtoul(end + 1, &end, 10);
+	codeRanges.emplace_back(offset, len);
+	pos = end - f[4].c_str() + 1;
+    }
+    record.addr = S::ParseAddress(f[5]);
+    record.isInPlt = (f[6] == "1");
+    record.section = f[7];
+    record.name = f[8];
+
+    while (in.peek() == 'C')  {
+	std::getline(in, line);
+	auto c = S::SplitLine(line);
+	if (c.size() < 5)  {
+	    return false;
+	}
+	CallRecord call;
+	call.callInsnAddr = S::ParseAddress(c[1]);
+	call.calledAddr = S::ParseAddress(c[2]);
+	call.isToPlt = (c[3] == "1");
+	size_t start = 0;
+	while (start < c[4].size())  {
+	    auto end = c[4].find(',', start);
+	    if (end == std::string::npos)  {
+		end = c[4].size();
+	    }
+	    char *nameStart;
+	    auto bit = strtoul(c[4].c_str() + start, &nameStart, 10);
+	    if (*nameStart != ':' || bit >= RegisterMask::numBits)  {
+		return false;
+	    }
+	    auto nameOffset = nameStart + 1 - c[4].c_str();
+	    names->SetRegister(bit, c[4].substr(nameOffset, end - nameOffset));
+	    call.liveRegs.Set(bit);
+	    start = end + 1;
+	}
+	for (size_t i = 5; i < c.size(); ++i)  {
+	    call.funcNames.push_back(names->Add(c[i]));
+	}
+	record.calls.push_back(std::move(call));
+    }
+
+    return true;
+}
+
+
+void StateFile::WriteHeader(std::ostream &out, const std::string &signature)
+{
+    out << "call_analyzer-state\t2\t" << Escape(signature) << '\n';
+}
+
+
+bool StateFile::ReadHeader(std::istream &in, const std::string &signature)
+{
+    std::string line;
+    if (!std::getline(in, line))  {
+	return false;
+    }
+    auto f = SplitLine(line);
+
+    return f.size() == 3 && f[0] == "call_analyzer-state" && f[1] == "2" && f[2] == signature;
+}
+
+
+std::string StateFile::Escape(const std::string &s)
+{
+    std::string out;
+    for (auto c: s)  {
+	if (c == '\t')  {
+	    out += "\\t";
+	}  else if (c == '\n')  {
+	    out += "\\n";
+	}  else  {
+	    if (c == '\\')  {
+		out += '\\';
+	    }
+	    out += c;
+	}
+    }
+
+    return out;
+}
+
+
+// Splits the line at tabs and removes the escapes from each field.
+std::vector<std::string> StateFile::SplitLine(const std::string &line)
+{
+    std::vector<std::string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i)  {
+	auto c = line[i];
+	if (c == '\t')  {
+	    fields.emplace_back();
+	}  else if (c == '\\' && i + 1 < line.size())  {
+	    c = line[++i];
+	    fields.back() += (c == 't') ? '\t' : (c == 'n') ? '\n' : c;
+	}  else  {
+	    fields.back() += c;
+	}
+    }
+
+    return fields;
+}
+
+
+std::string StateFile::AddressString(RecordAddress a)
+{
+    return a == noRecordAddress ? "-" : std::to_string(a);
+}
+
+
+RecordAddress StateFile::ParseAddress(const std::string &s)
+{
+    return s == "-" ? noRecordAddress : strtoul(s.c_str(), nullptr, 10);
+}
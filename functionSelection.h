@@ -0,0 +1,175 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <cstdint>
+#include <cstdlib>
+#include <regex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// The functions selected by --function, --function-regex, --address-range,
+// --section and --exported.  Each kind of selector given has to match:  a
+// name selector (--function or --function-regex) matches one of the
+// function's names, an address range its entry, a section the section
+// containing its entry, and --exported a function with an exported symbol.
+// An empty selection selects every function.
+class FunctionSelection
+{
+    public:
+	void AddName(const std::string &name)
+	{
+	    names.insert(name);
+	}
+	bool AddRegex(const std::string &pattern);
+	bool AddRange(const std::string &range);
+	void AddSection(const std::string &name)
+	{
+	    sections.insert(name);
+	}
+	void SelectExported()
+	{
+	    exported = true;
+	}
+	bool Empty() const
+	{
+	    return names.empty() && regexes.empty() && ranges.empty() && sections.empty() && !exported;
+	}
+	bool ExportedOnly() const
+	{
+	    return exported;
+	}
+	bool HasNameSelectors() const
+	{
+	    return !names.empty() || !regexes.empty();
+	}
+	bool MatchesLocation(uint64_t entry, const std::string &section) const;
+	bool MatchesName(const std::string &name) const;
+	std::string Description() const;
+    private:
+	std::set<std::string>					names;
+	std::vector<std::pair<std::string, std::regex>>		regexes;
+	std::set<std::pair<uint64_t, uint64_t>>			ranges;		// [start, end)
+	std::set<std::string>					sections;
+	bool							exported = false;
+};
+
+
+// Adds an ECMAScript regular expression that selects the functions with a
+// name containing a match.  Returns false if the pattern is invalid.
+bool FunctionSelection::AddRegex(const std::string &pattern)
+{
+    try  {
+	regexes.emplace_back(pattern, std::regex(pattern, std::regex::optimize));
+    }  catch (const std::regex_error &)  {
+	return false;
+    }
+
+    return true;
+}
+
+
+// Adds the entry addresses from START up to, but not including, END given
+// as "START-END" (decimal, or hex with a 0x prefix), or the single entry
+// address given as "START".  Returns false if the range is invalid or empty.
+bool FunctionSelection::AddRange(const std::string &range)
+{
+    auto dash = range.find('-');
+    auto startStr = range.substr(0, dash);
+    if (dash == std::string::npos)  {
+	char *startEnd;
+	uint64_t start = strtoull(startStr.c_str(), &startEnd, 0);
+	if (startStr.empty() || *startEnd != '\0' || start == UINT64_MAX)  {
+	    return false;
+	}
+	ranges.emplace(start, start + 1);
+	return true;
+    }
+
+    auto endStr = range.substr(dash + 1);
+    char *startEnd;
+    char *endEnd;
+    uint64_t start = strtoull(startStr.c_str(), &startEnd, 0);
+    uint64_t end = strtoull(endStr.c_str(), &endEnd, 0);
+    if (startStr.empty() || *startEnd != '\0' || endStr.empty() || *endEnd != '\0' || start >= end)  {
+	return false;
+    }
+    ranges.emplace(start, end);
+
+    return true;
+}
+
+
+// Returns true if the address and section selectors, if any, select a
+// function with the entry in the section.
+bool FunctionSelection::MatchesLocation(uint64_t entry, const std::string &section) const
+{
+    if (!sections.empty() && !sections.count(section))  {
+	return false;
+    }
+
+    if (ranges.empty())  {
+	return true;
+    }
+    for (auto &r: ranges)  {
+	if (entry >= r.first && entry < r.second)  {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+
+// Returns true if the name selectors select a function with the name.
+bool FunctionSelection::MatchesName(const std::string &name) const
+{
+    if (names.count(name))  {
+	return true;
+    }
+    for (auto &r: regexes)  {
+	if (std::regex_search(name, r.second))  {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+
+// Returns a canonical description of the selection, empty if it is empty.
+std::string FunctionSelection::Description() const
+{
+    std::string desc;
+    for (auto &n: names)  {
+	desc += "function " + n + '\n';
+    }
+    for (auto &r: regexes)  {
+	desc += "regex " + r.first + '\n';
+    }
+    for (auto &r: ranges)  {
+	desc += "range " + std::to_string(r.first) + ' ' + std::to_string(r.second) + '\n';
+    }
+    for (auto &s: sections)  {
+	desc += "section " + s + '\n';
+    }
+    if (exported)  {
+	desc += "exported\n";
+    }
+
+    return desc;
+}
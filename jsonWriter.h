@@ -15,10 +15,20 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <stack>
+#include <vector>
+#include <charconv>
+#include <cstdio>
 #include <cstdlib>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define JSON_WRITER_FATAL_ERR(msg)  do { std::cerr << __FILE__ << ":" << __LINE__ << " JsonWriter Fatal Error: " << msg << std::endl; abort(); } while (0)
 
+// Output is appended to a buffer that is written to the stream in chunks of
+// about flushSize bytes, and when End or Flush is called or the writer is
+// destroyed.  Call Flush before writing to the stream directly.
 class JsonWriter
 {
     public:
@@ -26,6 +36,9 @@ class JsonWriter
 	JsonWriter(int indentSpaces, int initialLevel = 0)
 	    : JsonWriter(std::cout, indentSpaces, initialLevel)
 	    {}
+	~JsonWriter();
+	JsonWriter(const JsonWriter &) = delete;
+	JsonWriter &operator=(const JsonWriter &) = delete;
 	void AddScalar(double d);
 	void AddScalar(int i);
 	void AddScalar(unsigned int u);
@@ -33,7 +46,7 @@ class JsonWriter
 	void AddScalar(unsigned long u);
 	void AddScalar(long long i);
 	void AddScalar(unsigned long long u);
-	void AddScalar(std::string s);
+	void AddScalar(std::string_view s);
 	void AddScalar(const char *s);
 	void AddScalar(bool b);
 	void AddNull();
@@ -41,10 +54,14 @@ class JsonWriter
 	void CloseArray();
 	void OpenObject();
 	void CloseObject();
-	void AddMemberKey(std::string s);
+	void AddMemberKey(std::string_view s);
 	void End();
 	void Reset();
+	void Flush();
+	static void AppendJsonString(std::string &out, std::string_view s);
     private:
+	static const size_t	flushSize = 1 << 20;
+
 	enum ItemType {noType, anyType, arrayElemType, objectMemberType};
 	enum ItemSpeciality {itemOrdinary, itemClosing, itemKey};
 	struct ItemState
@@ -61,7 +78,22 @@ class JsonWriter
 	void		IncElements();
 	int		NumElements();
 	void		RequiresAllowsAnyType();
-	std::string	JsonString(std::string s);
+	void		Put(char c)
+	{
+	    buf += c;
+	}
+	void		Put(std::string_view s)
+	{
+	    buf.append(s.data(), s.size());
+	}
+	template <typename T>
+	void		PutInteger(T i);
+	void		PutJsonString(std::string_view s)
+	{
+	    AppendJsonString(buf, s);
+	}
+	static size_t	FindEscape(std::string_view s, size_t i);
+	static size_t	Utf8Length(std::string_view s, size_t i);
 	void		WritePreitemPunctuation(ItemSpeciality speciality = itemOrdinary);
 	void		WriteDelim(char delim, ItemSpeciality speciality = itemOrdinary);
 	void		OpenItem(ItemType type, char delim);
@@ -69,7 +101,8 @@ class JsonWriter
 
 	std::ostream&		os;
 	int			indent;
-	std::stack<ItemState>	state;
+	std::stack<ItemState, std::vector<ItemState>>	state;
+	std::string		buf;
 };
 
 
@@ -78,85 +111,94 @@ JsonWriter::JsonWriter(std::ostream& outStream, int indentSpaces, int initialLev
 	os(outStream),
 	indent(indentSpaces)
 {
+    buf.reserve(flushSize + flushSize / 4);
     PushItem(anyType);
     CurItem().level = initialLevel;
 }
 
 
+JsonWriter::~JsonWriter()
+{
+    Flush();
+}
+
+
+// formatted as ostream's default for a double
 void JsonWriter::AddScalar(double d)
 {
     WritePreitemPunctuation();
-    os << d;
+    char s[32];
+    auto n = snprintf(s, sizeof s, "%g", d);
+    Put(std::string_view(s, n));
 }
 
 
 void JsonWriter::AddScalar(int i)
 {
     WritePreitemPunctuation();
-    os << i;
+    PutInteger(i);
 }
 
 
 void JsonWriter::AddScalar(unsigned int u)
 {
     WritePreitemPunctuation();
-    os << u;
+    PutInteger(u);
 }
 
 
 void JsonWriter::AddScalar(long i)
 {
     WritePreitemPunctuation();
-    os << i;
+    PutInteger(i);
 }
 
 
 void JsonWriter::AddScalar(unsigned long u)
 {
     WritePreitemPunctuation();
-    os << u;
+    PutInteger(u);
 }
 
 
 void JsonWriter::AddScalar(long long i)
 {
     WritePreitemPunctuation();
-    os << i;
+    PutInteger(i);
 }
 
 
 void JsonWriter::AddScalar(unsigned long long u)
 {
     WritePreitemPunctuation();
-    os << u;
+    PutInteger(u);
 }
 
 
-void JsonWriter::AddScalar(std::string s)
+void JsonWriter::AddScalar(std::string_view s)
 {
     WritePreitemPunctuation();
-    os << JsonString(s);
+    PutJsonString(s);
 }
 
 
 void JsonWriter::AddScalar(const char *s)
 {
-    WritePreitemPunctuation();
-    os << JsonString(s);
+    AddScalar(std::string_view(s));
 }
 
 
 void JsonWriter::AddScalar(bool b)
 {
     WritePreitemPunctuation();
-    os << (b ? "true" : "false");
+    Put(b ? "true" : "false");
 }
 
 
 void JsonWriter::AddNull()
 {
     WritePreitemPunctuation();
-    os << "null";
+    Put("null");
 }
 
 
@@ -187,18 +229,20 @@ void JsonWriter::CloseObject()
 }
 
 
-void JsonWriter::AddMemberKey(std::string s)
+void JsonWriter::AddMemberKey(std::string_view s)
 {
     WritePreitemPunctuation(itemKey);
-    os << JsonString(s) << ':';
+    PutJsonString(s);
+    Put(':');
 }
 
 
 void JsonWriter::End()
 {
     if (indent > 0)  {
-	os << '\n';
+	Put('\n');
     }
+    Flush();
 
     auto stackSize = state.size();
     if (stackSize > 1)  {
@@ -228,6 +272,15 @@ void JsonWriter::Reset()
 }
 
 
+void JsonWriter::Flush()
+{
+    if (!buf.empty())  {
+	os.write(buf.data(), buf.size());
+	buf.clear();
+    }
+}
+
+
 JsonWriter::ItemState& JsonWriter::CurItem()
 {
     return state.top();
@@ -285,28 +338,146 @@ void JsonWriter::RequiresAllowsAnyType()
 }
 
 
-std::string JsonWriter::JsonString(std::string s)
+template <typename T>
+void JsonWriter::PutInteger(T i)
 {
-    std::string out{"\""};
+    char s[24];
+    auto r = std::to_chars(s, s + sizeof s, i);
+    Put(std::string_view(s, r.ptr - s));
+}
+
 
-    for (auto c: s)  {
-	if (c == '\n')  {
-	    out += "\\n";
-	}  else  {
-	    if (c == '\\' || c == '"')  {
-		out += '\\';
+// Appends s to out as a JSON string (RFC 8259).  Quote, backslash and the
+// control characters are escaped, using the two character escapes where
+// there is one and \u00XX otherwise.  Each byte that is not part of a valid
+// UTF-8 sequence is replaced by U+FFFD, so the result is always valid
+// UTF-8.  The runs of bytes that need no change are found 16 at a time and
+// appended in one piece.
+void JsonWriter::AppendJsonString(std::string &out, std::string_view s)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    out += '"';
+
+    size_t start = 0;
+    for (auto i = FindEscape(s, 0); i < s.size(); i = FindEscape(s, start))  {
+	out.append(s.data() + start, i - start);
+	unsigned char c = s[i];
+	start = i + 1;
+	if (c >= 0x80)  {
+	    if (auto len = Utf8Length(s, i))  {
+		out.append(s.data() + i, len);
+		start = i + len;
+	    }  else  {
+		out += "\xef\xbf\xbd";
 	    }
-	    out += c;
+	    continue;
+	}
+
+	out += '\\';
+	switch (c)  {
+	    case '"':
+	    case '\\':
+		out += c;
+		break;
+	    case '\b':
+		out += 'b';
+		break;
+	    case '\f':
+		out += 'f';
+		break;
+	    case '\n':
+		out += 'n';
+		break;
+	    case '\r':
+		out += 'r';
+		break;
+	    case '\t':
+		out += 't';
+		break;
+	    default:
+		out += "u00";
+		out += hexDigits[c >> 4];
+		out += hexDigits[c & 0xf];
+		break;
+	}
+    }
+    out.append(s.data() + start, s.size() - start);
+
+    out += '"';
+}
+
+
+// Returns the index of the first byte at or after i that is a control
+// character, quote, backslash or not ASCII, or s.size() if there is none.
+size_t JsonWriter::FindEscape(std::string_view s, size_t i)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data());
+    auto n = s.size();
+
+#ifdef __SSE2__
+    // bytes >= 0x80 are negative, so the signed compare with 0x20 finds
+    // them along with the control characters
+    auto space = _mm_set1_epi8(0x20);
+    auto quote = _mm_set1_epi8('"');
+    auto backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= n; i += 16)  {
+	auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+	auto special = _mm_or_si128(_mm_cmplt_epi8(v, space),
+		_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+	if (auto mask = _mm_movemask_epi8(special))  {
+	    return i + __builtin_ctz(mask);
+	}
+    }
+#endif
+
+    for (; i < n; ++i)  {
+	auto c = p[i];
+	if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')  {
+	    return i;
 	}
     }
-    out += "\"";
 
-    return out;
+    return n;
+}
+
+
+// Returns the length of the valid UTF-8 sequence starting at i, or 0 if
+// there is none (RFC 3629:  no overlong forms, surrogates, or code points
+// above U+10FFFF).
+size_t JsonWriter::Utf8Length(std::string_view s, size_t i)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data()) + i;
+    auto n = s.size() - i;
+    auto isCont = [&](size_t j, unsigned char low = 0x80, unsigned char high = 0xbf)  {
+	return j < n && p[j] >= low && p[j] <= high;
+    };
+
+    auto c = p[0];
+    if (c >= 0xc2 && c <= 0xdf)  {
+	return isCont(1) ? 2 : 0;
+    }
+    if (c >= 0xe0 && c <= 0xef)  {
+	auto low = (c == 0xe0) ? 0xa0 : 0x80;
+	auto high = (c == 0xed) ? 0x9f : 0xbf;
+	return isCont(1, low, high) && isCont(2) ? 3 : 0;
+    }
+    if (c >= 0xf0 && c <= 0xf4)  {
+	auto low = (c == 0xf0) ? 0x90 : 0x80;
+	auto high = (c == 0xf4) ? 0x8f : 0xbf;
+	return isCont(1, low, high) && isCont(2) && isCont(3) ? 4 : 0;
+    }
+
+    return 0;
 }
 
 
 void JsonWriter::WritePreitemPunctuation(ItemSpeciality speciality)
 {
+    if (buf.size() >= flushSize)  {
+	Flush();
+    }
+
     auto type = CurItem().type;
     auto numElements = NumElements();
     bool isClosing = (speciality == itemClosing);
@@ -323,32 +494,32 @@ void JsonWriter::WritePreitemPunctuation(ItemSpeciality speciality)
 
 	if (type == objectMemberType && numElements % 2 == 1)  {
 	    if (indent != 0)  {
-		os << ' ';
+		Put(' ');
 	    }
 	    return;
 	}
 
 	if (numElements > 0 && !isClosing)  {
-	    os << ',';
+	    Put(',');
 	}
     }
 
     if (indent != 0 && type != anyType)  {
-	os << '\n';;
+	Put('\n');
     }
 
     auto level = CurItem().level;
     if (isClosing && level > 0)  {
 	--level;
     }
-    os << std::string(level * indent, ' ');
+    buf.append(level * indent, ' ');
 }
 
 
 void JsonWriter::WriteDelim(char delim, ItemSpeciality speciality)
 {
     WritePreitemPunctuation(speciality);
-    os << delim;
+    Put(delim);
 }
 
 
@@ -0,0 +1,65 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <cstdint>
+#include <cstdio>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+// The memory used by the process, as the kernel sees it (resident set size).
+class MemoryUsage
+{
+    public:
+	static uint64_t CurrentRss();
+	static uint64_t PeakRss();
+	static void ReleaseFreeMemory();
+};
+
+
+// Returns the current resident set size in bytes, or 0 if it is unknown.
+uint64_t MemoryUsage::CurrentRss()
+{
+    unsigned long size, resident = 0;
+    if (auto f = fopen("/proc/self/statm", "r"))  {
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2)  {
+	    resident = 0;
+	}
+	fclose(f);
+    }
+
+    return uint64_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+
+// Returns the largest resident set size of the process so far in bytes.
+uint64_t MemoryUsage::PeakRss()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))  {
+	return 0;
+    }
+
+    return uint64_t(usage.ru_maxrss) * 1024;
+}
+
+
+// Returns memory freed by the program, but still held by malloc, to the
+// system so it no longer counts in the resident set size.
+void MemoryUsage::ReleaseFreeMemory()
+{
+    malloc_trim(0);
+}
@@ -0,0 +1,569 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Reads and writes function records in call_analyzer's binary format, a
+// compact alternative to the JSON output that is much cheaper to parse.
+// Requires registerMask.h and functionRecord.h.
+//
+// The file is a header followed by length prefixed records:
+//
+//	file      = "CARF" version signature record* end
+//	version   = uint (3)
+//	signature = string (the options that produced the records)
+//	record    = uint (length of the function in bytes) function
+//	end       = uint (0)
+//	function  = numStrings:uint string* numRegisters:uint string*
+//		    name:index addr:address section:index flags:byte
+//		    numCalls:uint call*
+//	call      = callInsnAddr:address calledAddr:address flags:byte
+//		    liveRegs:regs [setRegs:regs] numFuncNames:uint index*
+//	regs      = bits			(list bit of the call's flags clear)
+//		  | numRegs:uint uint*		(list bit of the call's flags set)
+//
+// A uint is an unsigned LEB128 number (7 bits per byte, low bits first,
+// the high bit set on all but the last byte).  A string is a uint length
+// followed by that many bytes of UTF-8, not escaped.  An address is a uint
+// holding the address plus one, so 0 is noRecordAddress.  Bit 0 of a
+// function's flags is isInPlt, and of a call's flags is isToPlt.  Bit 1 of
+// a call's flags is the list bit of liveRegs, bit 2 is set if the call has
+// setRegs (hasSetRegs) and bit 3 is their list bit.  The other bits are 0.
+// Readers skip bytes left over at the end of a record, so later versions
+// can add fields at the end of a function.
+//
+// Names are written once.  The file has a string table, for the function,
+// section and called function names, and a register table, for the names
+// of the registers, both empty at the start of the file.  A function first
+// appends the strings and registers it is the first to use to the tables,
+// then refers to names by their index (a uint) in the table.  A register's
+// index in the table is its bit in the records' register masks, so a
+// function appends the names up to the highest bit it uses, with an empty
+// name for a bit that is not a register.  A call's registers are written as
+// bits:  an LEB128 number of any length, with bit i set if register i is in
+// the set.  Earlier writers wrote them as a list of register indexes when
+// their order was not that of the table, which can still be read.  The
+// records written to one file have to number their registers the same way,
+// as the records of one binary do.
+//
+// Version 1 files, without the tables and with each name written as a
+// string, and version 2 files, without setRegs, can still be read.  Their
+// registers are numbered in the order they are first used, so a call's
+// registers may be listed in a different order than they were written.
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+class RecordFileWriter
+{
+    public:
+	RecordFileWriter(std::ostream &out, const std::string &signature);
+	~RecordFileWriter();
+	RecordFileWriter(const RecordFileWriter &) = delete;
+	RecordFileWriter &operator=(const RecordFileWriter &) = delete;
+	void Write(const FunctionRecord &f);
+	void End();
+    private:
+	static const size_t	flushSize = 1 << 20;
+
+	static void	PutUint(std::string &s, uint64_t u);
+	static void	PutString(std::string &s, std::string_view str);
+	static void	PutAddress(std::string &s, RecordAddress a)
+	{
+	    PutUint(s, a + 1);
+	}
+	static void	PutBits(std::string &s, const RegisterMask &bits);
+	uint64_t	StringIndex(const std::string &str);
+	uint64_t	NameIndex(const FunctionRecord &f, RecordNames::Id id);
+	void		PutRegs(const FunctionRecord &f, const RegisterMask &regs);
+	void		Flush();
+
+	std::ostream					&out;
+	std::string					buf;
+	std::string					record;
+	std::string					newStrings;
+	std::string					newRegisters;
+	uint64_t					numNewStrings = 0;
+	uint64_t					numNewRegisters = 0;
+	std::unordered_map<std::string, uint64_t>	strings;
+	size_t						numRegisters = 0;
+	std::shared_ptr<RecordNames>			lastNames;
+	std::vector<uint64_t>				nameIndexes;
+};
+
+
+// Reads a file written by RecordFileWriter.  Errors in the file throw
+// std::runtime_error.
+class RecordFileReader
+{
+    public:
+	static const uint64_t version = 3;
+
+	RecordFileReader(std::istream &in);
+	const std::string &Signature() const
+	{
+	    return signature;
+	}
+	bool Read(FunctionRecord &f);
+    private:
+	void		ReadFunction(FunctionRecord &f);
+	void		ReadFunctionV1(FunctionRecord &f);
+	uint64_t	GetUint();
+	std::string	GetString();
+	RecordAddress	GetAddress()
+	{
+	    return GetUint() - 1;
+	}
+	const std::string	&GetIndexed(const std::vector<std::string> &table);
+	RecordNames::Id	GetName();
+	void		GetRegs(bool asList, RegisterMask &regs);
+	size_t		RegisterBit(const std::string &reg);
+	unsigned char	GetByte();
+	[[noreturn]] void	Malformed() const;
+
+	std::istream			&in;
+	uint64_t			fileVersion = 0;
+	std::string			signature;
+	std::string			record;
+	size_t				pos = 0;
+	bool				inRecord = false;
+	bool				atEnd = false;
+	std::vector<std::string>	strings;
+	std::vector<uint64_t>		nameIds;
+	size_t				numRegisters = 0;
+	std::unordered_map<std::string, size_t>	registerBits;
+	std::shared_ptr<RecordNames>	names = std::make_shared<RecordNames>();
+};
+
+
+RecordFileWriter::RecordFileWriter(std::ostream &out, const std::string &signature)
+    :
+	out(out)
+{
+    buf.reserve(flushSize + flushSize / 4);
+    buf += "CARF";
+    PutUint(buf, RecordFileReader::version);
+    PutString(buf, signature);
+}
+
+
+RecordFileWriter::~RecordFileWriter()
+{
+    Flush();
+}
+
+
+// Writes the function, preceded by the names it is the first to use.
+void RecordFileWriter::Write(const FunctionRecord &f)
+{
+    newStrings.clear();
+    newRegisters.clear();
+    numNewStrings = 0;
+    numNewRegisters = 0;
+
+    record.clear();
+    PutUint(record, StringIndex(f.name));
+    PutAddress(record, f.addr);
+    PutUint(record, StringIndex(f.section));
+    record += char(f.isInPlt);
+    PutUint(record, f.calls.size());
+    for (auto &call: f.calls)  {
+	PutAddress(record, call.callInsnAddr);
+	PutAddress(record, call.calledAddr);
+	record += char(call.isToPlt | (call.hasSetRegs ? 4 : 0));
+	PutRegs(f, call.liveRegs);
+	if (call.hasSetRegs)  {
+	    PutRegs(f, call.setRegs);
+	}
+	PutUint(record, call.funcNames.size());
+	for (auto id: call.funcNames)  {
+	    PutUint(record, NameIndex(f, id));
+	}
+    }
+
+    std::string tables;
+    PutUint(tables, numNewStrings);
+    tables += newStrings;
+    PutUint(tables, numNewRegisters);
+    tables += newRegisters;
+
+    PutUint(buf, tables.size() + record.size());
+    buf += tables;
+    buf += record;
+    if (buf.size() >= flushSize)  {
+	Flush();
+    }
+}
+
+
+// Writes the end of the file and flushes it.
+void RecordFileWriter::End()
+{
+    PutUint(buf, 0);
+    Flush();
+}
+
+
+void RecordFileWriter::PutUint(std::string &s, uint64_t u)
+{
+    while (u >= 0x80)  {
+	s += char(u | 0x80);
+	u >>= 7;
+    }
+    s += char(u);
+}
+
+
+void RecordFileWriter::PutString(std::string &s, std::string_view str)
+{
+    PutUint(s, str.size());
+    s.append(str.data(), str.size());
+}
+
+
+// Writes the number with the bits set as an LEB128 number of any length.
+void RecordFileWriter::PutBits(std::string &s, const RegisterMask &bits)
+{
+    size_t last = bits.numBits;
+    for (auto b = bits.FindFirst(); b < bits.numBits; b = bits.FindNext(b))  {
+	last = b;
+    }
+    if (last == bits.numBits)  {
+	s += '\0';
+	return;
+    }
+
+    auto start = s.size();
+    s.append(last / 7 + 1, char(0x80));
+    s.back() = 0;
+    for (auto b = bits.FindFirst(); b < bits.numBits; b = bits.FindNext(b))  {
+	s[start + b / 7] |= char(1 << (b % 7));
+    }
+}
+
+
+// Returns the index of the string in the string table, adding it to the
+// table and to the strings to write with the record if it is new.
+uint64_t RecordFileWriter::StringIndex(const std::string &str)
+{
+    auto i = strings.emplace(str, strings.size());
+    if (i.second)  {
+	PutString(newStrings, str);
+	++numNewStrings;
+    }
+
+    return i.first->second;
+}
+
+
+// Returns the index in the string table of the name with the id in the
+// function's names.  The indexes of the ids of the last names used are
+// kept, so a name is looked up by string only the first time.
+uint64_t RecordFileWriter::NameIndex(const FunctionRecord &f, RecordNames::Id id)
+{
+    if (f.names != lastNames)  {
+	lastNames = f.names;
+	nameIndexes.clear();
+    }
+    if (id >= nameIndexes.size())  {
+	nameIndexes.resize(id + 1, 0);
+    }
+
+    // an index plus one, 0 if not known yet
+    auto &index = nameIndexes[id];
+    if (index == 0)  {
+	index = StringIndex(f.names->Name(id)) + 1;
+    }
+
+    return index - 1;
+}
+
+
+// Writes the registers as bits, appending the names of the registers up to
+// the highest to the register table if they are not in it yet.
+void RecordFileWriter::PutRegs(const FunctionRecord &f, const RegisterMask &regs)
+{
+    for (auto b = regs.FindFirst(); b < regs.numBits; b = regs.FindNext(b))  {
+	for (; numRegisters <= b; ++numRegisters)  {
+	    PutString(newRegisters, f.names->Register(numRegisters));
+	    ++numNewRegisters;
+	}
+    }
+    PutBits(record, regs);
+}
+
+
+void RecordFileWriter::Flush()
+{
+    if (!buf.empty())  {
+	out.write(buf.data(), buf.size());
+	buf.clear();
+    }
+}
+
+
+RecordFileReader::RecordFileReader(std::istream &in)
+    :
+	in(in)
+{
+    char magic[4];
+    if (!in.read(magic, sizeof magic) || std::string_view(magic, sizeof magic) != "CARF")  {
+	throw std::runtime_error{"not a call_analyzer binary record file"};
+    }
+    fileVersion = GetUint();
+    if (fileVersion < 1 || fileVersion > version)  {
+	throw std::runtime_error{"unsupported call_analyzer binary record file version"};
+    }
+    signature = GetString();
+}
+
+
+// Reads the next function.  Returns false at the end of the file.
+bool RecordFileReader::Read(FunctionRecord &f)
+{
+    if (atEnd)  {
+	return false;
+    }
+
+    auto len = GetUint();
+    if (len == 0)  {
+	atEnd = true;
+	return false;
+    }
+    if (len > (uint64_t(1) << 32))  {
+	Malformed();
+    }
+    record.resize(len);
+    if (!in.read(&record[0], len))  {
+	Malformed();
+    }
+    pos = 0;
+    inRecord = true;
+
+    f = FunctionRecord{};
+    f.names = names;
+    if (fileVersion == 1)  {
+	ReadFunctionV1(f);
+    }  else  {
+	ReadFunction(f);
+    }
+    inRecord = false;
+
+    return true;
+}
+
+
+void RecordFileReader::ReadFunction(FunctionRecord &f)
+{
+    for (auto n = GetUint(); n > 0; --n)  {
+	strings.push_back(GetString());
+    }
+    for (auto n = GetUint(); n > 0; --n)  {
+	if (numRegisters == RegisterMask::numBits)  {
+	    Malformed();
+	}
+	names->SetRegister(numRegisters++, GetString());
+    }
+
+    f.name = GetIndexed(strings);
+    f.addr = GetAddress();
+    f.section = GetIndexed(strings);
+    f.isInPlt = GetByte() & 1;
+    for (auto n = GetUint(); n > 0; --n)  {
+	CallRecord call;
+	call.callInsnAddr = GetAddress();
+	call.calledAddr = GetAddress();
+	auto flags = GetByte();
+	call.isToPlt = flags & 1;
+	GetRegs(flags & 2, call.liveRegs);
+	call.hasSetRegs = flags & 4;
+	if (call.hasSetRegs)  {
+	    GetRegs(flags & 8, call.setRegs);
+	}
+	for (auto r = GetUint(); r > 0; --r)  {
+	    call.funcNames.push_back(GetName());
+	}
+	f.calls.push_back(std::move(call));
+    }
+}
+
+
+// Reads registers written as a list of indexes, or as bits.
+void RecordFileReader::GetRegs(bool asList, RegisterMask &regs)
+{
+    if (asList)  {
+	for (auto r = GetUint(); r > 0; --r)  {
+	    auto i = GetUint();
+	    if (i >= numRegisters)  {
+		Malformed();
+	    }
+	    regs.Set(i);
+	}
+	return;
+    }
+
+    for (uint64_t bit = 0; ; bit += 7)  {
+	auto c = GetByte();
+	for (int i = 0; i < 7; ++i)  {
+	    if (c & (1 << i))  {
+		if (bit + i >= numRegisters)  {
+		    Malformed();
+		}
+		regs.Set(bit + i);
+	    }
+	}
+	if (!(c & 0x80))  {
+	    break;
+	}
+    }
+}
+
+
+// Reads a function from a version 1 file, with the names as strings.
+void RecordFileReader::ReadFunctionV1(FunctionRecord &f)
+{
+    f.name = GetString();
+    f.addr = GetAddress();
+    f.section = GetString();
+    f.isInPlt = GetByte() & 1;
+    for (auto n = GetUint(); n > 0; --n)  {
+	CallRecord call;
+	call.callInsnAddr = GetAddress();
+	call.calledAddr = GetAddress();
+	call.isToPlt = GetByte() & 1;
+	for (auto r = GetUint(); r > 0; --r)  {
+	    call.liveRegs.Set(RegisterBit(GetString()));
+	}
+	for (auto r = GetUint(); r > 0; --r)  {
+	    call.funcNames.push_back(names->Add(GetString()));
+	}
+	f.calls.push_back(std::move(call));
+    }
+}
+
+
+// Reads from the current record, or from the stream between records.
+unsigned char RecordFileReader::GetByte()
+{
+    if (inRecord)  {
+	if (pos >= record.size())  {
+	    Malformed();
+	}
+	return record[pos++];
+    }
+
+    auto c = in.get();
+    if (c == std::istream::traits_type::eof())  {
+	Malformed();
+    }
+    return c;
+}
+
+
+uint64_t RecordFileReader::GetUint()
+{
+    uint64_t u = 0;
+    for (int shift = 0; shift < 64; shift += 7)  {
+	auto c = GetByte();
+	u |= uint64_t(c & 0x7f) << shift;
+	if (!(c & 0x80))  {
+	    return u;
+	}
+    }
+    Malformed();
+}
+
+
+std::string RecordFileReader::GetString()
+{
+    auto len = GetUint();
+    if (inRecord)  {
+	if (len > record.size() - pos)  {
+	    Malformed();
+	}
+	pos += len;
+	return record.substr(pos - len, len);
+    }
+
+    if (len > (uint64_t(1) << 20))  {
+	Malformed();
+    }
+    std::string s(len, '\0');
+    if (!in.read(&s[0], len))  {
+	Malformed();
+    }
+    return s;
+}
+
+
+// Reads an index and returns the name it refers to in the table.
+const std::string &RecordFileReader::GetIndexed(const std::vector<std::string> &table)
+{
+    auto i = GetUint();
+    if (i >= table.size())  {
+	Malformed();
+    }
+
+    return table[i];
+}
+
+
+// Reads an index into the string table and returns the id of that name in
+// names, adding it the first time.
+RecordNames::Id RecordFileReader::GetName()
+{
+    auto i = GetUint();
+    if (i >= strings.size())  {
+	Malformed();
+    }
+    if (nameIds.size() < strings.size())  {
+	nameIds.resize(strings.size(), 0);
+    }
+
+    // an id plus one, 0 if not added yet
+    auto &id = nameIds[i];
+    if (id == 0)  {
+	id = uint64_t(names->Add(strings[i])) + 1;
+    }
+
+    return id - 1;
+}
+
+
+// Returns the bit of a register named in a version 1 file, numbering it
+// the first time.
+size_t RecordFileReader::RegisterBit(const std::string &reg)
+{
+    auto i = registerBits.emplace(reg, numRegisters);
+    if (i.second)  {
+	if (numRegisters == RegisterMask::numBits)  {
+	    Malformed();
+	}
+	names->SetRegister(numRegisters++, reg);
+    }
+
+    return i.first->second;
+}
+
+
+void RecordFileReader::Malformed() const
+{
+    throw std::runtime_error{"malformed or truncated call_analyzer binary record file"};
+}
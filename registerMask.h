@@ -0,0 +1,181 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <cstddef>
+#include <cstdint>
+
+
+// A set of bit indices [0, NumBits) stored inline in a few machine words, so
+// copying and combining sets never allocates.  Used for sets of registers
+// identified by their ABI index.
+template <size_t NumBits>
+class BitMask
+{
+    public:
+	static const size_t numBits = NumBits;
+
+	void Set(size_t i)
+	{
+	    words[i / wordBits] |= Word(1) << (i % wordBits);
+	}
+	void Reset(size_t i)
+	{
+	    words[i / wordBits] &= ~(Word(1) << (i % wordBits));
+	}
+	bool Test(size_t i) const
+	{
+	    return (words[i / wordBits] >> (i % wordBits)) & 1;
+	}
+	bool Any() const;
+	size_t Count() const;
+	size_t FindFirst() const
+	{
+	    return FindFrom(0);
+	}
+	size_t FindNext(size_t i) const
+	{
+	    return FindFrom(i + 1);
+	}
+
+	BitMask &operator|=(const BitMask &m);
+	BitMask &operator&=(const BitMask &m);
+	BitMask operator|(const BitMask &m) const
+	{
+	    BitMask r{*this};
+	    return r |= m;
+	}
+	BitMask operator&(const BitMask &m) const
+	{
+	    BitMask r{*this};
+	    return r &= m;
+	}
+	BitMask operator~() const;
+	bool operator==(const BitMask &m) const;
+	bool operator!=(const BitMask &m) const
+	{
+	    return !(*this == m);
+	}
+    private:
+	using Word = uint64_t;
+	static const size_t wordBits = 64;
+	static const size_t numWords = (NumBits + wordBits - 1) / wordBits;
+
+	size_t		FindFrom(size_t i) const;
+
+	Word		words[numWords] = {};
+};
+
+
+template <size_t NumBits>
+bool BitMask<NumBits>::Any() const
+{
+    for (auto w: words)  {
+	if (w)  {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+
+template <size_t NumBits>
+size_t BitMask<NumBits>::Count() const
+{
+    size_t n = 0;
+    for (auto w: words)  {
+	n += __builtin_popcountll(w);
+    }
+
+    return n;
+}
+
+
+// Returns the smallest index >= i in the set, or numBits if there is none.
+template <size_t NumBits>
+size_t BitMask<NumBits>::FindFrom(size_t i) const
+{
+    if (i >= numBits)  {
+	return numBits;
+    }
+
+    auto w = i / wordBits;
+    auto bits = words[w] & (~Word(0) << (i % wordBits));
+    while (true)  {
+	if (bits)  {
+	    return w * wordBits + __builtin_ctzll(bits);
+	}
+	if (++w == numWords)  {
+	    return numBits;
+	}
+	bits = words[w];
+    }
+}
+
+
+template <size_t NumBits>
+BitMask<NumBits> &BitMask<NumBits>::operator|=(const BitMask &m)
+{
+    for (size_t i = 0; i < numWords; ++i)  {
+	words[i] |= m.words[i];
+    }
+
+    return *this;
+}
+
+
+template <size_t NumBits>
+BitMask<NumBits> &BitMask<NumBits>::operator&=(const BitMask &m)
+{
+    for (size_t i = 0; i < numWords; ++i)  {
+	words[i] &= m.words[i];
+    }
+
+    return *this;
+}
+
+
+// Returns the set of the indices [0, numBits) not in the set.
+template <size_t NumBits>
+BitMask<NumBits> BitMask<NumBits>::operator~() const
+{
+    BitMask r;
+    for (size_t i = 0; i < numWords; ++i)  {
+	r.words[i] = ~words[i];
+    }
+    if (numBits % wordBits)  {
+	r.words[numWords - 1] &= ~(~Word(0) << (numBits % wordBits));
+    }
+
+    return r;
+}
+
+
+template <size_t NumBits>
+bool BitMask<NumBits>::operator==(const BitMask &m) const
+{
+    for (size_t i = 0; i < numWords; ++i)  {
+	if (words[i] != m.words[i])  {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+
+// Large enough for the ABI register index maps of the architectures
+// call_analyzer supports; the AbiRegisters constructor checks it.
+using RegisterMask = BitMask<512>;
@@ -0,0 +1,281 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+
+// A directory of results, one file per key.  Results are written to a
+// temporary file in the directory and renamed into place, so concurrent
+// processes sharing the directory only ever see complete results.  Reading a
+// result updates its modification time, and after each store the least
+// recently used results are removed until the directory is at most maxBytes
+// (0 is unlimited).
+class ResultCache
+{
+    public:
+	ResultCache(const std::string &dir, uint64_t maxBytes);
+	bool Fetch(const std::string &key, std::ostream &out);
+	bool Fetch(const std::string &key, std::string &data);
+	std::string NewTempFile(std::ofstream &f);
+	void Commit(const std::string &tempPath, const std::string &key);
+	void Discard(const std::string &tempPath);
+	void Store(const std::string &key, const std::string &data);
+    private:
+	std::string	EntryPath(const std::string &key) const;
+	void		Touch(const std::string &path);
+	void		Evict();
+
+	std::filesystem::path	dir;
+	uint64_t		maxBytes;
+};
+
+
+// Writes everything written to it to two stream buffers.  A failure of the
+// second buffer does not fail the stream; check SecondFailed instead.
+class TeeStreambuf : public std::streambuf
+{
+    public:
+	TeeStreambuf(std::streambuf *first, std::streambuf *second)
+	    : first(first), second(second)
+	    {}
+	bool SecondFailed() const
+	{
+	    return secondFailed;
+	}
+    protected:
+	int_type overflow(int_type c) override;
+	std::streamsize xsputn(const char *s, std::streamsize n) override;
+	int sync() override;
+    private:
+	std::streambuf	*first;
+	std::streambuf	*second;
+	bool		secondFailed = false;
+};
+
+
+ResultCache::ResultCache(const std::string &dir, uint64_t maxBytes)
+    :
+	dir(dir),
+	maxBytes(maxBytes)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(this->dir, ec);
+    if (!std::filesystem::is_directory(this->dir))  {
+	throw std::runtime_error{"unable to create cache directory '" + dir + "'"};
+    }
+}
+
+
+bool ResultCache::Fetch(const std::string &key, std::ostream &out)
+{
+    auto path = EntryPath(key);
+    std::ifstream f(path, std::ios::binary);
+    if (!f || f.peek() == std::ifstream::traits_type::eof())  {
+	return false;
+    }
+
+    out << f.rdbuf();
+    Touch(path);
+
+    return bool(out);
+}
+
+
+bool ResultCache::Fetch(const std::string &key, std::string &data)
+{
+    auto path = EntryPath(key);
+    std::ifstream f(path, std::ios::binary);
+    if (!f)  {
+	return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    if (f.bad() || data.empty())  {
+	return false;
+    }
+    Touch(path);
+
+    return true;
+}
+
+
+// Opens a new uniquely named temporary file in the cache directory for a
+// result that is later passed to Commit or Discard.
+std::string ResultCache::NewTempFile(std::ofstream &f)
+{
+    static std::atomic<unsigned> counter{0};
+    static thread_local std::mt19937_64 random{std::random_device{}()};
+
+    auto name = "tmp." + std::to_string(getpid()) + '.' + std::to_string(counter++)
+	    + '.' + std::to_string(random());
+    auto path = (dir / name).string();
+    f.open(path, std::ios::binary | std::ios::trunc);
+
+    return path;
+}
+
+
+void ResultCache::Commit(const std::string &tempPath, const std::string &key)
+{
+    std::error_code ec;
+    std::filesystem::rename(tempPath, EntryPath(key), ec);
+    if (ec)  {
+	Discard(tempPath);
+	return;
+    }
+
+    Evict();
+}
+
+
+void ResultCache::Discard(const std::string &tempPath)
+{
+    std::error_code ec;
+    std::filesystem::remove(tempPath, ec);
+}
+
+
+void ResultCache::Store(const std::string &key, const std::string &data)
+{
+    std::ofstream f;
+    auto tempPath = NewTempFile(f);
+    f.write(data.data(), data.size());
+    f.close();
+    if (f)  {
+	Commit(tempPath, key);
+    }  else  {
+	Discard(tempPath);
+    }
+}
+
+
+std::string ResultCache::EntryPath(const std::string &key) const
+{
+    return (dir / key).string();
+}
+
+
+void ResultCache::Touch(const std::string &path)
+{
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+}
+
+
+// Removes the least recently used results until the cache fits in maxBytes.
+// Other processes may be removing the same files, so errors are ignored.
+// Temporary files are left alone unless they are a day old, in which case
+// the process writing them is assumed to have died.
+void ResultCache::Evict()
+{
+    namespace fs = std::filesystem;
+
+    if (maxBytes == 0)  {
+	return;
+    }
+
+    struct Entry
+    {
+	fs::file_time_type	time;
+	uintmax_t		size;
+	fs::path		path;
+    };
+
+    std::vector<Entry> entries;
+    uintmax_t totalBytes = 0;
+    auto staleTime = fs::file_time_type::clock::now() - std::chrono::hours(24);
+    std::error_code ec;
+    for (fs::directory_iterator i(dir, ec), end; !ec && i != end; i.increment(ec))  {
+	auto size = i->file_size(ec);
+	auto time = i->last_write_time(ec);
+	if (ec)  {
+	    ec.clear();
+	    continue;
+	}
+	if (i->path().filename().string().compare(0, 4, "tmp.") == 0)  {
+	    if (time < staleTime)  {
+		fs::remove(i->path(), ec);
+	    }
+	    continue;
+	}
+	entries.push_back({time, size, i->path()});
+	totalBytes += size;
+    }
+
+    if (totalBytes <= maxBytes)  {
+	return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)  {
+	return a.time < b.time;
+    });
+    for (auto &e: entries)  {
+	if (totalBytes <= maxBytes)  {
+	    break;
+	}
+	fs::remove(e.path, ec);
+	totalBytes -= e.size;
+    }
+}
+
+
+TeeStreambuf::int_type TeeStreambuf::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))  {
+	return traits_type::not_eof(c);
+    }
+
+    if (traits_type::eq_int_type(first->sputc(c), traits_type::eof()))  {
+	return traits_type::eof();
+    }
+    if (!secondFailed && traits_type::eq_int_type(second->sputc(c), traits_type::eof()))  {
+	secondFailed = true;
+    }
+
+    return c;
+}
+
+
+std::streamsize TeeStreambuf::xsputn(const char *s, std::streamsize n)
+{
+    auto written = first->sputn(s, n);
+    if (!secondFailed && second->sputn(s, written) != written)  {
+	secondFailed = true;
+    }
+
+    return written;
+}
+
+
+int TeeStreambuf::sync()
+{
+    if (!secondFailed && second->pubsync() == -1)  {
+	secondFailed = true;
+    }
+
+    return first->pubsync();
+}
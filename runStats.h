@@ -0,0 +1,223 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Building blocks for the statistics reported by --stats:  the time spent
+// in each phase, the slowest functions, and the number of bytes written.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <time.h>
+
+
+// The wall clock and CPU time spent in a phase, summed over the threads
+// that ran it, and the number of times it ran.  Any thread can add to it.
+class PhaseTime
+{
+    public:
+	void Add(uint64_t wallNs, uint64_t cpuNs)
+	{
+	    wall += wallNs;
+	    cpu += cpuNs;
+	    ++count;
+	}
+	double WallSeconds() const
+	{
+	    return wall * 1e-9;
+	}
+	double CpuSeconds() const
+	{
+	    return cpu * 1e-9;
+	}
+	uint64_t Count() const
+	{
+	    return count;
+	}
+    private:
+	std::atomic<uint64_t>	wall{0};
+	std::atomic<uint64_t>	cpu{0};
+	std::atomic<uint64_t>	count{0};
+};
+
+
+// Adds the time from its construction to its destruction to a phase, or
+// does nothing if the phase is null.  The CPU time is the calling thread's,
+// or the whole process's if processCpu (for a phase that runs threads of
+// its own, and nothing else runs at the same time).
+class PhaseTimer
+{
+    public:
+	PhaseTimer(PhaseTime *phase, bool processCpu = false);
+	~PhaseTimer();
+	PhaseTimer(const PhaseTimer &) = delete;
+	PhaseTimer &operator=(const PhaseTimer &) = delete;
+	static uint64_t CpuNs(clockid_t clock);
+    private:
+	PhaseTime				*phase;
+	clockid_t				clock;
+	uint64_t				cpuStart = 0;
+	std::chrono::steady_clock::time_point	wallStart;
+};
+
+
+// Keeps the numKept functions that took the longest.  Any thread can add to
+// it; once it is full, adding a function faster than all of those kept only
+// reads an atomic.
+class SlowestFunctions
+{
+    public:
+	struct Function
+	{
+	    double		seconds;
+	    std::string		name;
+	    uint64_t		entry;
+	    size_t		numBlocks;
+	};
+
+	SlowestFunctions(size_t numKept)
+	    : numKept(numKept)
+	    {}
+	bool IsSlowest(double seconds) const
+	{
+	    return seconds > threshold;
+	}
+	void Add(Function f);
+	std::vector<Function> Sorted() const;
+    private:
+	static bool Slower(const Function &a, const Function &b)
+	{
+	    return a.seconds > b.seconds;
+	}
+
+	size_t			numKept;
+	std::atomic<double>	threshold{-1};
+	mutable std::mutex	mutex;
+	std::vector<Function>	heap;		// the fastest kept on top
+};
+
+
+// Passes the output on to another streambuf, counting the bytes written.
+class CountingStreambuf : public std::streambuf
+{
+    public:
+	CountingStreambuf(std::streambuf *out)
+	    : out(out)
+	    {}
+	uint64_t Count() const
+	{
+	    return count;
+	}
+    protected:
+	int_type overflow(int_type c) override;
+	std::streamsize xsputn(const char *s, std::streamsize n) override;
+	int sync() override
+	{
+	    return out->pubsync();
+	}
+    private:
+	std::streambuf	*out;
+	uint64_t	count = 0;
+};
+
+
+PhaseTimer::PhaseTimer(PhaseTime *phase, bool processCpu)
+    :
+	phase(phase),
+	clock(processCpu ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID)
+{
+    if (phase)  {
+	cpuStart = CpuNs(clock);
+	wallStart = std::chrono::steady_clock::now();
+    }
+}
+
+
+PhaseTimer::~PhaseTimer()
+{
+    if (phase)  {
+	std::chrono::nanoseconds wall = std::chrono::steady_clock::now() - wallStart;
+	phase->Add(wall.count(), CpuNs(clock) - cpuStart);
+    }
+}
+
+
+// Returns the CPU time used so far by the thread or process in nanoseconds.
+uint64_t PhaseTimer::CpuNs(clockid_t clock)
+{
+    timespec t;
+    if (clock_gettime(clock, &t))  {
+	return 0;
+    }
+
+    return uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+
+void SlowestFunctions::Add(Function f)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (heap.size() == numKept)  {
+	if (numKept == 0 || f.seconds <= heap.front().seconds)  {
+	    return;
+	}
+	std::pop_heap(heap.begin(), heap.end(), Slower);
+	heap.pop_back();
+    }
+    heap.push_back(std::move(f));
+    std::push_heap(heap.begin(), heap.end(), Slower);
+    if (heap.size() == numKept)  {
+	threshold = heap.front().seconds;
+    }
+}
+
+
+// Returns the functions kept, slowest first.
+std::vector<SlowestFunctions::Function> SlowestFunctions::Sorted() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto sorted = heap;
+    std::sort(sorted.begin(), sorted.end(), Slower);
+
+    return sorted;
+}
+
+
+CountingStreambuf::int_type CountingStreambuf::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))  {
+	return traits_type::not_eof(c);
+    }
+
+    if (traits_type::eq_int_type(out->sputc(c), traits_type::eof()))  {
+	return traits_type::eof();
+    }
+    ++count;
+
+    return c;
+}
+
+
+std::streamsize CountingStreambuf::xsputn(const char *s, std::streamsize n)
+{
+    auto written = out->sputn(s, n);
+    count += written;
+
+    return written;
+}
@@ -0,0 +1,183 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+
+// SHA-256 (FIPS 180-4) message digest.
+class Sha256
+{
+    public:
+	Sha256();
+	void Update(const void *data, size_t len);
+	void Update(const std::string &s)
+	{
+	    Update(s.data(), s.size());
+	}
+	std::string HexDigest();
+	static std::string HexDigest(const std::string &s);
+	static bool HexDigestFile(const std::string &path, std::string &digest);
+    private:
+	void		Transform(const unsigned char *block);
+
+	uint32_t	h[8];
+	unsigned char	buffer[64];
+	size_t		bufferLen = 0;
+	uint64_t	totalLen = 0;
+};
+
+
+Sha256::Sha256()
+    :
+	h{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+{
+}
+
+
+void Sha256::Update(const void *data, size_t len)
+{
+    auto p = static_cast<const unsigned char *>(data);
+    totalLen += len;
+
+    if (bufferLen > 0)  {
+	auto n = std::min(len, sizeof buffer - bufferLen);
+	memcpy(buffer + bufferLen, p, n);
+	bufferLen += n;
+	p += n;
+	len -= n;
+	if (bufferLen < sizeof buffer)  {
+	    return;
+	}
+	Transform(buffer);
+	bufferLen = 0;
+    }
+
+    for (; len >= sizeof buffer; p += sizeof buffer, len -= sizeof buffer)  {
+	Transform(p);
+    }
+
+    memcpy(buffer, p, len);
+    bufferLen = len;
+}
+
+
+std::string Sha256::HexDigest()
+{
+    uint64_t bitLen = totalLen * 8;
+    unsigned char pad[72] = {0x80};
+    auto padLen = (bufferLen < 56 ? 56 : 120) - bufferLen;
+    for (int i = 0; i < 8; ++i)  {
+	pad[padLen + i] = bitLen >> (56 - 8 * i);
+    }
+    Update(pad, padLen + 8);
+
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string digest;
+    for (auto word: h)  {
+	for (int shift = 28; shift >= 0; shift -= 4)  {
+	    digest += hexDigits[(word >> shift) & 0xf];
+	}
+    }
+
+    return digest;
+}
+
+
+std::string Sha256::HexDigest(const std::string &s)
+{
+    Sha256 sha;
+    sha.Update(s);
+    return sha.HexDigest();
+}
+
+
+bool Sha256::HexDigestFile(const std::string &path, std::string &digest)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)  {
+	return false;
+    }
+
+    Sha256 sha;
+    char buf[1 << 16];
+    while (f.read(buf, sizeof buf) || f.gcount() > 0)  {
+	sha.Update(buf, f.gcount());
+    }
+    if (f.bad())  {
+	return false;
+    }
+
+    digest = sha.HexDigest();
+    return true;
+}
+
+
+void Sha256::Transform(const unsigned char *block)
+{
+    static const uint32_t k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    auto rotr = [](uint32_t x, int n)  { return (x >> n) | (x << (32 - n)); };
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)  {
+	w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16
+		| uint32_t(block[4 * i + 2]) << 8 | uint32_t(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 64; ++i)  {
+	auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+	auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+	w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; ++i)  {
+	auto s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+	auto ch = (e & f) ^ (~e & g);
+	auto t1 = hh + s1 + ch + k[i] + w[i];
+	auto s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+	auto maj = (a & b) ^ (a & c) ^ (b & c);
+	auto t2 = s0 + maj;
+	hh = g;
+	g = f;
+	f = e;
+	e = d + t1;
+	d = c;
+	c = b;
+	b = a;
+	a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+}
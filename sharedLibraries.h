@@ -0,0 +1,320 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// Finds the shared libraries binaries depend on (DT_NEEDED), the way the
+// dynamic linker would, and the functions each exports, so a call through
+// the PLT can be resolved to the library and address of its definition.
+// Requires elfFile.h.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <glob.h>
+
+
+class SharedLibraries
+{
+    public:
+	// A binary or library.  Its scope is the order its undefined functions
+	// are looked up in:  itself, then its dependencies breadth first.
+	struct Object
+	{
+	    std::string				path;
+	    int					elfClass = 0;
+	    unsigned				machine = 0;
+	    std::vector<std::string>		needed;
+	    std::string				rpath;
+	    std::string				runpath;
+	    std::vector<const Object *>		dependencies;
+	    std::vector<std::string>		missing;	// needed, not found
+	    std::map<std::string, uint64_t>	exports;
+	    std::vector<const Object *>		scope;
+	};
+
+	SharedLibraries(const std::string &sysroot, const std::vector<std::string> &libraryPath);
+	SharedLibraries(const SharedLibraries &) = delete;
+	SharedLibraries &operator=(const SharedLibraries &) = delete;
+	const Object *Add(const std::string &path);
+	const std::vector<const Object *> &Libraries() const
+	{
+	    return libraries;
+	}
+	static const Object *Resolve(const Object &object, const std::string &name, uint64_t &addr);
+    private:
+	Object *Load(const std::string &path);
+	std::string Find(const std::string &name, const Object &requester) const;
+	std::vector<std::string> SearchPath(const std::string &path, const Object &requester) const;
+	bool IsCompatible(const std::string &path, const Object &requester) const;
+	void ReadLdSoConf(const std::string &path, int depth);
+	static std::string CanonicalPath(const std::string &path);
+	static void SetScope(Object &object);
+
+	std::string					sysroot;
+	std::vector<std::string>			libraryPath;
+	std::vector<std::string>			systemDirs;
+	std::map<std::string, std::unique_ptr<Object>>	objects;	// by canonical path
+	std::vector<const Object *>			libraries;
+};
+
+
+// The sysroot is prefixed to the system directories and the absolute
+// directories of RPATHs and RUNPATHs.  The libraryPath directories are
+// searched as given, like LD_LIBRARY_PATH.
+SharedLibraries::SharedLibraries(const std::string &sysroot, const std::vector<std::string> &libraryPath)
+    :
+	sysroot(sysroot),
+	libraryPath(libraryPath)
+{
+    ReadLdSoConf(sysroot + "/etc/ld.so.conf", 0);
+    for (auto dir: {"/lib64", "/usr/lib64", "/lib", "/usr/lib"})  {
+	systemDirs.push_back(sysroot + dir);
+    }
+}
+
+
+// Adds the binary at path and the libraries it depends on, directly or
+// indirectly, and returns the binary.  A library already added is shared.
+const SharedLibraries::Object *SharedLibraries::Add(const std::string &path)
+{
+    using namespace std;
+
+    auto numLibraries = libraries.size();
+    auto root = Load(path);
+    vector<Object *> added{root};
+    for (size_t i = 0; i < added.size(); ++i)  {
+	auto object = added[i];
+	if (!object->scope.empty())  {
+	    continue;
+	}
+	for (auto &name: object->needed)  {
+	    auto found = Find(name, *object);
+	    if (found.empty())  {
+		object->missing.push_back(name);
+		continue;
+	    }
+	    auto canonical = CanonicalPath(found);
+	    bool isNew = !objects.count(canonical);
+	    auto library = Load(found);
+	    object->dependencies.push_back(library);
+	    if (isNew)  {
+		libraries.push_back(library);
+		added.push_back(library);
+	    }
+	}
+    }
+
+    // the scopes need all the dependencies of the new objects
+    SetScope(*root);
+    for (auto i = numLibraries; i < libraries.size(); ++i)  {
+	SetScope(*const_cast<Object *>(libraries[i]));
+    }
+
+    return root;
+}
+
+
+// Returns the object in the scope of object defining the function name,
+// ignoring a version suffix ("name@VERSION"), and sets addr to its address
+// there.  Returns nullptr if no object defines it.
+const SharedLibraries::Object *SharedLibraries::Resolve(const Object &object, const std::string &name, uint64_t &addr)
+{
+    auto base = name.substr(0, name.find('@'));
+    for (auto o: object.scope)  {
+	auto f = o->exports.find(base);
+	if (f != o->exports.end())  {
+	    addr = f->second;
+	    return o;
+	}
+    }
+
+    return nullptr;
+}
+
+
+// Returns the object for path, reading it the first time.  A file that is
+// not an ELF file is an object with no dependencies or exports.
+SharedLibraries::Object *SharedLibraries::Load(const std::string &path)
+{
+    auto canonical = CanonicalPath(path);
+    auto &object = objects[canonical];
+    if (!object)  {
+	object.reset(new Object);
+	object->path = canonical;
+	ElfFile elf(path);
+	object->elfClass = elf.Class();
+	object->machine = elf.Machine();
+	elf.Dependencies(object->needed, object->rpath, object->runpath);
+	elf.ExportedFunctions(object->exports);
+    }
+
+    return object.get();
+}
+
+
+// Returns the path of the library name needed by requester, or "" if it is
+// not found.  A name with a slash is a path.  Otherwise the directories are
+// searched in the dynamic linker's order:  the requester's RPATH (if it has
+// no RUNPATH), libraryPath, the requester's RUNPATH, then the directories
+// of ld.so.conf and the system directories.  Unlike the dynamic linker, the
+// RPATHs of the objects that loaded the requester and ld.so.cache are not
+// used.
+std::string SharedLibraries::Find(const std::string &name, const Object &requester) const
+{
+    using namespace std;
+
+    if (name.find('/') != string::npos)  {
+	auto path = name[0] == '/' ? sysroot + name : name;
+	return IsCompatible(path, requester) ? path : "";
+    }
+
+    vector<string> dirs;
+    if (requester.runpath.empty())  {
+	dirs = SearchPath(requester.rpath, requester);
+    }
+    dirs.insert(dirs.end(), libraryPath.begin(), libraryPath.end());
+    auto runpath = SearchPath(requester.runpath, requester);
+    dirs.insert(dirs.end(), runpath.begin(), runpath.end());
+    dirs.insert(dirs.end(), systemDirs.begin(), systemDirs.end());
+
+    for (auto &dir: dirs)  {
+	auto path = dir + '/' + name;
+	if (IsCompatible(path, requester))  {
+	    return path;
+	}
+    }
+
+    return "";
+}
+
+
+// Returns the directories of a colon separated RPATH or RUNPATH, with
+// $ORIGIN replaced by the requester's directory.
+std::vector<std::string> SharedLibraries::SearchPath(const std::string &path, const Object &requester) const
+{
+    using namespace std;
+
+    vector<string> dirs;
+    auto origin = filesystem::path(requester.path).parent_path().string();
+    size_t start = 0;
+    while (start < path.size())  {
+	auto end = min(path.find(':', start), path.size());
+	auto dir = path.substr(start, end - start);
+	start = end + 1;
+	if (dir.empty())  {
+	    continue;
+	}
+	if (dir[0] == '/')  {
+	    dir = sysroot + dir;
+	}
+	for (auto var: {"${ORIGIN}", "$ORIGIN"})  {
+	    for (auto pos = dir.find(var); pos != string::npos; pos = dir.find(var))  {
+		dir.replace(pos, strlen(var), origin);
+	    }
+	}
+	dirs.push_back(dir);
+    }
+
+    return dirs;
+}
+
+
+// Returns true if path is an ELF file the requester can load:  the same
+// class and machine.
+bool SharedLibraries::IsCompatible(const std::string &path, const Object &requester) const
+{
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(path, ec))  {
+	return false;
+    }
+
+    ElfFile elf(path);
+    return elf.IsValid() && elf.Class() == requester.elfClass && elf.Machine() == requester.machine;
+}
+
+
+// Adds the directories listed in the ld.so.conf file at path, following its
+// include directives.
+void SharedLibraries::ReadLdSoConf(const std::string &path, int depth)
+{
+    using namespace std;
+
+    ifstream conf(path);
+    if (!conf || depth > 8)  {
+	return;
+    }
+
+    string line;
+    while (getline(conf, line))  {
+	line = line.substr(0, line.find('#'));
+	auto start = line.find_first_not_of(" \t");
+	if (start == string::npos)  {
+	    continue;
+	}
+	auto end = line.find_last_not_of(" \t\r");
+	line = line.substr(start, end - start + 1);
+
+	if (!line.compare(0, 8, "include ") || !line.compare(0, 8, "include\t"))  {
+	    auto pattern = line.substr(line.find_first_not_of(" \t", 8));
+	    if (pattern[0] == '/')  {
+		pattern = sysroot + pattern;
+	    }  else  {
+		pattern = filesystem::path(path).parent_path().string() + '/' + pattern;
+	    }
+	    glob_t matches;
+	    if (!glob(pattern.c_str(), 0, nullptr, &matches))  {
+		for (size_t i = 0; i < matches.gl_pathc; ++i)  {
+		    ReadLdSoConf(matches.gl_pathv[i], depth + 1);
+		}
+	    }
+	    globfree(&matches);
+	}  else if (line[0] == '/')  {
+	    systemDirs.push_back(sysroot + line);
+	}
+    }
+}
+
+
+std::string SharedLibraries::CanonicalPath(const std::string &path)
+{
+    std::error_code ec;
+    auto canonical = std::filesystem::canonical(path, ec);
+
+    return ec ? path : canonical.string();
+}
+
+
+// Sets the object's scope:  itself, then its dependencies breadth first,
+// each once.
+void SharedLibraries::SetScope(Object &object)
+{
+    using namespace std;
+
+    set<const Object *> seen{&object};
+    object.scope = {&object};
+    for (size_t i = 0; i < object.scope.size(); ++i)  {
+	for (auto d: object.scope[i]->dependencies)  {
+	    if (seen.insert(d).second)  {
+		object.scope.push_back(d);
+	    }
+	}
+    }
+}
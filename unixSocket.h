@@ -0,0 +1,237 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+// A line oriented server on a Unix domain socket:  a listening socket, and
+// the connections accepted from it.
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Listens on the socket at path, replacing a socket left there by an
+// earlier server that is gone; a socket another server still listens on is
+// an error.  Errors throw std::runtime_error.  The socket is removed when
+// destroyed, unless it was replaced since.  Stop makes Accept return -1, now and from then on; it only
+// writes to a pipe, so it can be called from any thread or a signal handler.
+class UnixSocketServer
+{
+    public:
+	UnixSocketServer(const std::string &path);
+	~UnixSocketServer();
+	UnixSocketServer(const UnixSocketServer &) = delete;
+	UnixSocketServer &operator=(const UnixSocketServer &) = delete;
+	int Accept();
+	void Stop();
+    private:
+	static bool	IsListening(const sockaddr_un &addr);
+
+	std::string	path;
+	int		fd = -1;
+	int		stopPipe[2] = {-1, -1};
+	struct stat	created{};
+};
+
+
+// A connection accepted by UnixSocketServer, read a line at a time.  It
+// closes the socket when destroyed.
+class SocketConnection
+{
+    public:
+	static const size_t	maxLineSize = 1 << 16;
+
+	SocketConnection(int fd)
+	    : fd(fd)
+	    {}
+	~SocketConnection()
+	{
+	    close(fd);
+	}
+	SocketConnection(const SocketConnection &) = delete;
+	SocketConnection &operator=(const SocketConnection &) = delete;
+	bool ReadLine(std::string &line);
+	bool Write(const std::string &s);
+    private:
+	int		fd;
+	std::string	buf;
+};
+
+
+UnixSocketServer::UnixSocketServer(const std::string &path)
+    :
+	path(path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path)  {
+	throw std::runtime_error{"socket path '" + path + "' is too long"};
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    // only a socket nothing listens on is replaced, never another kind of
+    // file
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))  {
+	if (IsListening(addr))  {
+	    throw std::runtime_error{"socket '" + path + "' is already in use"};
+	}
+	unlink(path.c_str());
+    }
+
+    // nonblocking, so a client going away between poll and accept4 does not
+    // block Accept
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr)
+	    || listen(fd, SOMAXCONN) || pipe2(stopPipe, O_CLOEXEC))  {
+	auto error = std::string{strerror(errno)};
+	if (fd >= 0)  {
+	    close(fd);
+	}
+	throw std::runtime_error{"unable to listen on socket '" + path + "': " + error};
+    }
+    lstat(path.c_str(), &created);
+}
+
+
+UnixSocketServer::~UnixSocketServer()
+{
+    close(fd);
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+
+    // another server may have replaced the socket after this one was gone
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && st.st_dev == created.st_dev
+	    && st.st_ino == created.st_ino)  {
+	unlink(path.c_str());
+    }
+}
+
+
+// Returns true if a server listens on the socket at addr, false if
+// connecting to it is refused (or it is gone).  Other errors, such as not
+// being allowed to connect, throw std::runtime_error, as the socket may be
+// in use.
+bool UnixSocketServer::IsListening(const sockaddr_un &addr)
+{
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)  {
+	throw std::runtime_error{std::string{"unable to create socket: "} + strerror(errno)};
+    }
+    auto r = connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr);
+    auto error = errno;
+    close(fd);
+    if (r == 0)  {
+	return true;
+    }
+    if (error == ECONNREFUSED || error == ENOENT)  {
+	return false;
+    }
+
+    throw std::runtime_error{"socket '" + std::string{addr.sun_path} + "' is already in use: "
+	    + strerror(error)};
+}
+
+
+// Returns the next connection's file descriptor, or -1 once Stop was
+// called.  Errors other than an interrupted call or a connection aborted by
+// the client throw std::runtime_error.  The connection is blocking.
+int UnixSocketServer::Accept()
+{
+    for (;;)  {
+	pollfd fds[] = {{fd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+	if (poll(fds, 2, -1) < 0)  {
+	    if (errno == EINTR)  {
+		continue;
+	    }
+	    throw std::runtime_error{std::string{"poll failed: "} + strerror(errno)};
+	}
+	// the byte written by Stop is never read, so every later call stops too
+	if (fds[1].revents)  {
+	    return -1;
+	}
+
+	auto conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (conn >= 0)  {
+	    return conn;
+	}
+	if (errno != EINTR && errno != ECONNABORTED
+		&& errno != EAGAIN && errno != EWOULDBLOCK)  {
+	    throw std::runtime_error{std::string{"accept failed: "} + strerror(errno)};
+	}
+    }
+}
+
+
+void UnixSocketServer::Stop()
+{
+    char c = 0;
+    while (write(stopPipe[1], &c, 1) < 0 && errno == EINTR)  {
+    }
+}
+
+
+// Reads the next line, without the newline.  Returns false at the end of
+// the connection, or if the line is longer than maxLineSize.
+bool SocketConnection::ReadLine(std::string &line)
+{
+    for (;;)  {
+	auto end = buf.find('\n');
+	if (end != std::string::npos)  {
+	    line.assign(buf, 0, end);
+	    buf.erase(0, end + 1);
+	    return true;
+	}
+	if (buf.size() > maxLineSize)  {
+	    return false;
+	}
+
+	char data[4096];
+	auto n = read(fd, data, sizeof data);
+	if (n < 0 && errno == EINTR)  {
+	    continue;
+	}
+	if (n <= 0)  {
+	    return false;
+	}
+	buf.append(data, n);
+    }
+}
+
+
+// Writes all of s.  Returns false if the client went away.
+bool SocketConnection::Write(const std::string &s)
+{
+    size_t written = 0;
+    while (written < s.size())  {
+	auto n = send(fd, s.data() + written, s.size() - written, MSG_NOSIGNAL);
+	if (n < 0 && errno == EINTR)  {
+	    continue;
+	}
+	if (n <= 0)  {
+	    return false;
+	}
+	written += n;
+    }
+
+    return true;
+}
@@ -0,0 +1,276 @@
+//  Copyright 2022 James A. Kupsch
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Runs a fixed set of tasks, identified by the indices [0, numTasks), on
+// numThreads worker threads.  Indices are dealt round-robin to per-worker
+// queues in index order, so callers put the most expensive tasks first.  A
+// worker takes tasks from the front of its own queue and when that is empty
+// steals from the front of the other queues, so the expensive tasks are still
+// started first.  No tasks are added once started, so a worker exits when all
+// the queues are empty.
+class WorkStealingPool
+{
+    public:
+	using Task = std::function<void(size_t)>;
+
+	WorkStealingPool(unsigned numThreads);
+	~WorkStealingPool();
+	void Start(size_t numTasks, Task t);
+	void Wait();
+	static unsigned HardwareThreads();
+    private:
+	struct WorkQueue
+	{
+	    std::mutex		mutex;
+	    std::deque<size_t>	tasks;
+	};
+
+	bool		PopTask(unsigned queueId, size_t &taskId);
+	bool		NextTask(unsigned workerId, size_t &taskId);
+	void		Worker(unsigned workerId);
+
+	unsigned				numThreads;
+	Task					task;
+	std::vector<std::unique_ptr<WorkQueue>>	queues;
+	std::vector<std::thread>		threads;
+	std::mutex				errorMutex;
+	std::exception_ptr			error;
+};
+
+
+// Hands results produced out of order by worker threads to a single consumer
+// in index order.  Take blocks until the result for the index is available,
+// and rethrows the exception if the producer of that index failed.  To bound
+// the results held, a producer can call WaitForRoom before producing index
+// i, which blocks until i is within window of the next index to be taken (a
+// window of 0 is unbounded).  The tasks must then be started in index order,
+// or out of order only within groups of at most window consecutive indices,
+// so the next index to be taken is always being produced.  Cancel is called
+// by the consumer when it stops taking:  WaitForRoom then returns false at
+// once, and the producer skips the work.
+template <typename T>
+class ReorderBuffer
+{
+    public:
+	ReorderBuffer(size_t size)
+	    : slots(size)
+	    {}
+	void Put(size_t i, T value);
+	void PutError(size_t i, std::exception_ptr e);
+	T Take(size_t i);
+	bool WaitForRoom(size_t i);
+	void Cancel();
+	void SetWindow(size_t w);
+	size_t Window()
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    return window;
+	}
+    private:
+	struct Slot
+	{
+	    bool		ready = false;
+	    T			value;
+	    std::exception_ptr	error;
+	};
+
+	std::mutex		mutex;
+	std::condition_variable	cond;
+	std::vector<Slot>	slots;
+	size_t			numTaken = 0;
+	size_t			window = 0;
+	bool			cancelled = false;
+};
+
+
+WorkStealingPool::WorkStealingPool(unsigned numThreads)
+    :
+	numThreads(numThreads > 0 ? numThreads : 1)
+{
+}
+
+
+WorkStealingPool::~WorkStealingPool()
+{
+    for (auto &t: threads)  {
+	if (t.joinable())  {
+	    t.join();
+	}
+    }
+}
+
+
+unsigned WorkStealingPool::HardwareThreads()
+{
+    auto n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+
+void WorkStealingPool::Start(size_t numTasks, Task t)
+{
+    task = std::move(t);
+
+    queues.clear();
+    for (unsigned i = 0; i < numThreads; ++i)  {
+	queues.emplace_back(new WorkQueue);
+    }
+    for (size_t i = 0; i < numTasks; ++i)  {
+	queues[i % numThreads]->tasks.push_back(i);
+    }
+
+    for (unsigned i = 0; i < numThreads; ++i)  {
+	threads.emplace_back(&WorkStealingPool::Worker, this, i);
+    }
+}
+
+
+void WorkStealingPool::Wait()
+{
+    for (auto &t: threads)  {
+	t.join();
+    }
+    threads.clear();
+
+    if (error)  {
+	std::rethrow_exception(error);
+    }
+}
+
+
+bool WorkStealingPool::PopTask(unsigned queueId, size_t &taskId)
+{
+    auto &q = *queues[queueId];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty())  {
+	return false;
+    }
+    taskId = q.tasks.front();
+    q.tasks.pop_front();
+
+    return true;
+}
+
+
+bool WorkStealingPool::NextTask(unsigned workerId, size_t &taskId)
+{
+    for (unsigned i = 0; i < numThreads; ++i)  {
+	if (PopTask((workerId + i) % numThreads, taskId))  {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+
+void WorkStealingPool::Worker(unsigned workerId)
+{
+    size_t taskId;
+    while (NextTask(workerId, taskId))  {
+	try  {
+	    task(taskId);
+	}  catch (...)  {
+	    std::lock_guard<std::mutex> lock(errorMutex);
+	    if (!error)  {
+		error = std::current_exception();
+	    }
+	}
+    }
+}
+
+
+template <typename T>
+void ReorderBuffer<T>::Put(size_t i, T value)
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	slots[i].value = std::move(value);
+	slots[i].ready = true;
+    }
+    cond.notify_all();
+}
+
+
+template <typename T>
+void ReorderBuffer<T>::PutError(size_t i, std::exception_ptr e)
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	slots[i].error = e;
+	slots[i].ready = true;
+    }
+    cond.notify_all();
+}
+
+
+template <typename T>
+T ReorderBuffer<T>::Take(size_t i)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]{ return slots[i].ready; });
+
+    auto &slot = slots[i];
+    ++numTaken;
+    cond.notify_all();
+    if (slot.error)  {
+	std::rethrow_exception(slot.error);
+    }
+
+    return std::move(slot.value);
+}
+
+
+// Returns false if cancelled, so index i is not wanted.
+template <typename T>
+bool ReorderBuffer<T>::WaitForRoom(size_t i)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]{ return cancelled || window == 0 || i < numTaken + window; });
+
+    return !cancelled;
+}
+
+
+template <typename T>
+void ReorderBuffer<T>::Cancel()
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	cancelled = true;
+    }
+    cond.notify_all();
+}
+
+
+template <typename T>
+void ReorderBuffer<T>::SetWindow(size_t w)
+{
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+	window = w;
+    }
+    cond.notify_all();
+}